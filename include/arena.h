@@ -0,0 +1,59 @@
+/* Include guard */
+#if !defined(ARENA_H)
+#define ARENA_H
+
+/* Linear allocator for per-frame scratch memory */
+
+/* Includes */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Consts */
+/* Every allocation is aligned to a cache line */
+#define ARENA_ALIGN 64
+/* The main block is grown in steps of this size */
+#define ARENA_GRANULE (64 * 1024)
+
+/*
+ * Arena struct:
+ * - allocations are bumped out of one big block
+ * - if a frame runs past the end, the extra allocations get their own blocks,
+ *   and on the next reset the main block is grown to the frame's high-water
+ *   mark, so steady state frames never touch the heap
+ * - not thread safe, every thread should have its own arena
+ */
+typedef struct {
+  uint8_t *base;
+  size_t capacity;
+  size_t used;
+  /* Overflow blocks (linked list), freed on reset */
+  void *overflow;
+  size_t overflow_used;
+  /* Most in use at once this frame, before anything was trimmed */
+  size_t high_water;
+  /*
+   * Stats: the high-water mark of the last frame and of every frame so far
+   * (what the main block needs to fit them), and how often it grew
+   */
+  size_t peak;
+  size_t last_frame;
+  uint32_t grows;
+} arena_t;
+
+/* Create arena */
+extern void arena_create(arena_t *arena, size_t capacity);
+/* Destroy arena */
+extern void arena_destroy(arena_t *arena);
+/* Allocate from arena, memory is valid until the next reset */
+extern void *arena_alloc(arena_t *arena, size_t size);
+/*
+ * Shrink the last allocation to size bytes, for allocating the most something
+ * could need then keeping only what it used. Returns where it is now, it's
+ * moved to a smaller block if it had a block of its own. The arena still grows
+ * to fit the untrimmed size.
+ */
+extern void *arena_trim(arena_t *arena, void *ptr, size_t size);
+/* Reset arena, call once per frame */
+extern void arena_reset(arena_t *arena);
+
+#endif /* ARENA_H */
@@ -0,0 +1,43 @@
+/* Include guard */
+#if !defined(BATCH_H)
+#define BATCH_H
+
+/* Headless batch rendering of many camera views in parallel */
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <renderer.h>
+
+/* Camera pose */
+typedef struct {
+  vec3_t pos;
+  float pitch, yaw;
+  float fov;
+} batch_pose_t;
+/* Batch config */
+typedef struct {
+  /* Output path pattern, png or ppm (see capture.h) */
+  const char *output;
+  uint32_t width, height;
+  /* Worker threads, 0 for one per cpu */
+  uint32_t threads;
+} batch_config_t;
+
+/*
+ * Load poses from a file, one "x y z pitch yaw fov" per line, '#' starts a
+ * comment. Returns NULL on failure, free() the result.
+ */
+extern batch_pose_t *batch_load_poses(const char *path, uint32_t *count);
+/*
+ * Render every pose of a mesh, each worker thread has its own renderer and
+ * they all share the (read only) mesh. Returns the number of frames written.
+ */
+extern uint32_t batch_render(
+    const batch_config_t *config,
+    const batch_pose_t *poses,
+    uint32_t num_poses,
+    const mesh_t *mesh
+);
+
+#endif /* BATCH_H */
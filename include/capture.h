@@ -0,0 +1,84 @@
+/* Include guard */
+#if !defined(CAPTURE_H)
+#define CAPTURE_H
+
+/* Asynchronous frame capture to image sequences or raw video streams */
+
+/* Includes */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <threads.h>
+#include <renderer.h>
+
+/* Output formats */
+typedef enum {
+  /*
+   * Image sequences, path has one %u (or %0Nu, zero padded to N digits) for
+   * the frame number, %% for a literal %
+   */
+  CAPTURE_PPM,
+  CAPTURE_PNG,
+  /* Streams, path is a file, "-" for stdout or "|command" for a pipe */
+  CAPTURE_Y4M,
+  CAPTURE_RGBA,
+} capture_format_t;
+
+/* Capture config */
+typedef struct {
+  capture_format_t format;
+  const char *path;
+  /* Number of frames that can be queued for the writer */
+  uint32_t slots;
+  /* When the writer falls behind: true waits for it, false drops frames */
+  bool block;
+  /* Frame rate for stream headers */
+  uint32_t fps;
+} capture_config_t;
+
+/* Capture struct */
+typedef struct {
+  capture_config_t config;
+  char *path;
+  uint32_t width, height;
+  FILE *stream;
+  bool pipe;
+  /* Ring of recycled frames, filled at tail and written from head */
+  uint32_t **frames;
+  uint64_t *frame_numbers;
+  uint32_t head, tail, count;
+  mtx_t lock;
+  cnd_t not_empty, not_full;
+  thrd_t writer;
+  bool stopping;
+  /* Writer scratch memory */
+  uint8_t *scratch;
+  /* Stats */
+  uint64_t submitted, written, dropped;
+  bool failed;
+} capture_t;
+
+/* Guess the format from a path's extension (raw rgba if unknown) */
+extern capture_format_t capture_guess_format(const char *path);
+/* Start capturing frames of the given size, returns false on failure */
+extern bool capture_create(
+    capture_t *capture,
+    const capture_config_t *config,
+    uint32_t width,
+    uint32_t height
+);
+/* Finish writing queued frames and stop */
+extern void capture_destroy(capture_t *capture);
+/*
+ * Queue the renderer's current frame, returns false if it was dropped (writer
+ * behind or failed, or the renderer is not the capture's size)
+ */
+extern bool capture_frame(capture_t *capture, renderer_t *renderer);
+/* Same as capture_frame(), but with an explicit frame number for sequences */
+extern bool capture_frame_numbered(
+    capture_t *capture,
+    renderer_t *renderer,
+    uint64_t number
+);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,53 @@
+/* Include guard */
+#if !defined(DISTRIB_H)
+#define DISTRIB_H
+
+/*
+ * Sort-last rendering over several processes on one host: each process draws
+ * its share of the scene into its own renderer, then the partial frames are
+ * merged by depth test (direct-send, through shared memory)
+ */
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <renderer.h>
+#include <batch.h>
+
+/* Consts */
+/* Most processes a frame can be split over */
+#define DISTRIB_MAX_PROCESSES 64
+
+/* Distributed render config */
+typedef struct {
+  /* Output path pattern, png or ppm (see capture.h) */
+  const char *output;
+  uint32_t width, height;
+  /* Renderer processes, including this one */
+  uint32_t processes;
+} distrib_config_t;
+
+/*
+ * Split a mesh into its share for one of a number of processes, heightfields
+ * by rows of cells and triangle meshes by ranges of triangles. share_field is
+ * filled in for heightfields and points into the original's data.
+ */
+extern void distrib_share(
+    const mesh_t *mesh,
+    uint32_t rank,
+    uint32_t ranks,
+    mesh_t *share,
+    heightfield_t *share_field
+);
+/*
+ * Render every pose of a mesh with it split over forked processes, the first
+ * (this one) writes the composited frames. Returns the number written.
+ */
+extern uint32_t distrib_render(
+    const distrib_config_t *config,
+    const batch_pose_t *poses,
+    uint32_t num_poses,
+    const mesh_t *mesh
+);
+
+#endif /* DISTRIB_H */
@@ -0,0 +1,108 @@
+/* Include guard */
+#if !defined(JOBS_H)
+#define JOBS_H
+
+/* Work stealing job scheduler, shared by every stage of the renderer */
+
+/* Includes */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <arena.h>
+
+/* Consts */
+/* Jobs a worker can have queued, submitting more runs them inline */
+#define JOBS_QUEUE_SIZE 1024
+/* Size of each worker's scratch arena to start with */
+#define JOBS_ARENA_SIZE (256 * 1024)
+/* Set to override the number of workers (one per cpu by default) */
+#define JOBS_ENV "RENDERER_THREADS"
+
+/*
+ * Job function, runs items [begin, end) of a job's range. worker is the index
+ * of the worker running it, for jobs_arena().
+ */
+typedef void (*job_fn_t)(
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    uint32_t worker
+);
+/*
+ * Counts unfinished jobs, zero initialise it. Work that depends on some jobs
+ * waits on their counter with jobs_wait().
+ */
+typedef struct {
+  atomic_uint pending;
+} job_counter_t;
+/* Job */
+typedef struct {
+  job_fn_t fn;
+  void *data;
+  uint32_t begin, end;
+  job_counter_t *counter;
+} job_t;
+/*
+ * Worker struct:
+ * - the owner pushes and pops jobs at the bottom of its queue, idle workers
+ *   steal the oldest jobs from the top
+ * - each worker has its own arena, reset with jobs_reset()
+ */
+typedef struct {
+  struct jobs *jobs;
+  mtx_t lock;
+  job_t queue[JOBS_QUEUE_SIZE];
+  uint32_t top, bottom;
+  arena_t arena;
+} job_worker_t;
+/*
+ * Scheduler struct:
+ * - worker 0 is the thread that created it (and submits the work), the rest
+ *   are threads of their own
+ * - only one thread outside the scheduler should submit to it at a time
+ * - workers sleep while there's nothing queued
+ */
+typedef struct jobs {
+  uint32_t num_workers;
+  job_worker_t *workers;
+  thrd_t *threads;
+  /* Queued jobs, over every worker */
+  atomic_uint queued;
+  atomic_bool stopping;
+  mtx_t sleep_lock;
+  cnd_t wake;
+} jobs_t;
+
+/* Start a scheduler with a number of workers, 0 for one per cpu */
+extern bool jobs_create(jobs_t *jobs, uint32_t workers);
+/* Stop the scheduler, queued jobs must have finished */
+extern void jobs_destroy(jobs_t *jobs);
+/* Queue a job over [begin, end), counting it in counter (may be NULL) */
+extern void jobs_submit(
+    jobs_t *jobs,
+    job_fn_t fn,
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    job_counter_t *counter
+);
+/* Wait for a counter to reach zero, running jobs in the meantime */
+extern void jobs_wait(jobs_t *jobs, job_counter_t *counter);
+/*
+ * Split [0, count) into jobs of up to grain items (each starting at a multiple
+ * of grain) and wait for them all
+ */
+extern void jobs_parallel_for(
+    jobs_t *jobs,
+    job_fn_t fn,
+    void *data,
+    uint32_t count,
+    uint32_t grain
+);
+/* Scratch arena of a worker, only use it from inside that worker's jobs */
+extern arena_t *jobs_arena(jobs_t *jobs, uint32_t worker);
+/* Reset every worker's arena, call once per frame while nothing is running */
+extern void jobs_reset(jobs_t *jobs);
+
+#endif /* JOBS_H */
@@ -0,0 +1,47 @@
+/* Include guard */
+#if !defined(KERNELS_H)
+#define KERNELS_H
+
+/* Hot loop kernels, compiled once per instruction set */
+
+/* Includes */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <renderer.h>
+
+/* Environment variable to force a kernel set, e.g. RENDERER_ISA=generic */
+#define KERNELS_ENV "RENDERER_ISA"
+
+/* Kernel table */
+typedef struct kernels {
+  /* Name of the instruction set */
+  const char *name;
+  /* Whether this table was actually built for its instruction set */
+  bool built;
+  /* Clear colour and depth buffers inside a rect */
+  void (*clear)(renderer_t *renderer, rect_t rect);
+  /* Transform triangle points by a matrix (w = 1) */
+  void (*transform)(tri_t *tris, size_t count, const m4x4_t *m);
+  /*
+   * Rasterize a triangle in screen space, only inside clip (which must be in
+   * the scissor rect), one per depth format and raster pipeline state
+   */
+  void (*rasterize[DEPTH_FORMATS][PIPELINE_RASTER_STATES])(
+      renderer_t *renderer,
+      const tri_t *tri,
+      const rect_t *clip
+  );
+  /* Detile the framebuffer into dst, pitch is in bytes */
+  void (*resolve)(const renderer_t *renderer, uint32_t *dst, size_t pitch);
+} kernels_t;
+
+/* Kernel sets, best last */
+extern const kernels_t kernels_generic;
+extern const kernels_t kernels_avx2;
+extern const kernels_t kernels_avx512;
+
+/* Pick the best kernel set for this cpu (or the one forced by KERNELS_ENV) */
+extern const kernels_t *kernels_select(void);
+
+#endif /* KERNELS_H */
@@ -3,23 +3,82 @@
 #define RENDERER_H
 
 /* Includes */
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <la.h>
+#include <arena.h>
+#include <jobs.h>
 
 /* Triangle struct */
 typedef struct {
   vec3_t points[3];
   vec3_t cols[3];
 } tri_t;
+/*
+ * Heightfield struct:
+ * - a grid of (width+1) x (depth+1) heights one unit apart in x and z, row
+ *   major with x fastest, each cell drawn as two triangles
+ * - colours is optional, one per height, otherwise the height is used as a
+ *   grey level
+ * - triangles are generated in the vertex stage, never stored
+ */
+typedef struct {
+  uint32_t width, depth;
+  float *heights;
+  vec3_t *colours;
+} heightfield_t;
 /* Mesh struct */
 typedef struct {
   uint32_t num_tris;
   tri_t *tris;
+  /* If set the triangles come from this instead, and tris is ignored */
+  const heightfield_t *heightfield;
   vec3_t translate;
   vec3_t scale;
   vec3_t rotate;
+  /* Bump after changing tris or the transform, so renderers recache it */
+  uint32_t version;
+  /*
+   * Optional model space unit face normals, one per triangle (not used for
+   * heightfields). While normals_version matches version renderers cull
+   * backfaces with them before copying or transforming anything, and threads
+   * share them read only like tris. See mesh_update_normals().
+   */
+  vec3_t *normals;
+  uint32_t normals_version;
 } mesh_t;
+/* Triangles per mesh chunk, the unit of vertex jobs and chunk culling */
+#define MESH_CHUNK_TRIS 1024
+/* Triangles per quantized mesh chunk */
+#define QMESH_CHUNK_TRIS 1024
+/* Largest quantized position, a chunk spans origin to origin + this * scale */
+#define QMESH_POS_MAX 65535
+/* Quantized vertex, 16 bit position relative to its chunk and rgba8 colour */
+typedef struct {
+  uint16_t pos[3];
+  uint8_t col[4];
+} qvert_t;
+/* Quantized triangle, 30 bytes instead of 72 */
+typedef struct {
+  qvert_t verts[3];
+} qtri_t;
+/* Quantized mesh chunk, position = origin + pos * scale */
+typedef struct {
+  vec3_t origin;
+  vec3_t scale;
+  uint32_t first_tri, num_tris;
+} qchunk_t;
+/* Quantized mesh struct */
+typedef struct {
+  uint32_t num_tris;
+  qtri_t *tris;
+  uint32_t num_chunks;
+  qchunk_t *chunks;
+  vec3_t translate;
+  vec3_t scale;
+  vec3_t rotate;
+} qmesh_t;
 /* Camera struct */
 typedef struct {
   vec3_t pos;
@@ -29,31 +88,236 @@ typedef struct {
   float pitch, yaw;
   float far, near;
 } camera_t;
+/*
+ * Bounds of a mesh in its own space, kept by the renderer between frames.
+ * Triangles are read straight from the mesh, so renderers on many threads
+ * share one read only copy.
+ */
+typedef struct {
+  const mesh_t *mesh;
+  /* Triangles or heightfield it was built from */
+  const void *source;
+  bool valid;
+  uint32_t version;
+  uint32_t num_tris;
+  vec3_t min, max;
+  /*
+   * Bounds of each MESH_CHUNK_TRIS triangles (or block of heightfield rows,
+   * about as many triangles), and how many fit
+   */
+  vec3_t *chunk_min, *chunk_max;
+  uint32_t capacity;
+} mesh_cache_t;
+/* Screen rect, x1 and y1 are exclusive */
+typedef struct {
+  uint32_t x0, y0, x1, y1;
+} rect_t;
+/* A mesh as it was drawn in the last frame */
+typedef struct {
+  const mesh_t *mesh;
+  uint32_t version;
+  rect_t rect;
+} mesh_state_t;
+/* What the last frame drew, for incremental rendering */
+typedef struct {
+  bool valid;
+  camera_t camera;
+  uint32_t pipeline;
+  uint32_t width, height;
+  mesh_state_t *meshes;
+  uint32_t num_meshes, capacity;
+} frame_state_t;
+/*
+ * Depth buffer formats, every one clips samples past the far plane (when
+ * depth is tested or written)
+ */
+typedef enum {
+  /* 32 bit float, 0 at near */
+  DEPTH_F32,
+  /* 32 bit float, 1 at near and 0 at far, more precise far away */
+  DEPTH_F32_REVERSED,
+  /* 16 and 24 bit fixed point, 0 at near */
+  DEPTH_UNORM16,
+  DEPTH_UNORM24,
+  DEPTH_FORMATS
+} depth_format_t;
+#define DEPTH_UNORM16_MAX 0xFFFF
+#define DEPTH_UNORM24_MAX 0xFFFFFF
+/* A DEPTH_UNORM24 element, packed into 3 bytes (little endian) */
+typedef struct {
+  uint8_t bytes[3];
+} depth24_t;
+#define DEPTH24_LOAD(d) ( \
+    (uint32_t)(d)->bytes[0] | (uint32_t)(d)->bytes[1] << 8 \
+    | (uint32_t)(d)->bytes[2] << 16 \
+)
+#define DEPTH24_STORE(d, z) do { \
+    (d)->bytes[0] = (uint8_t)(z); \
+    (d)->bytes[1] = (uint8_t)((z) >> 8); \
+    (d)->bytes[2] = (uint8_t)((z) >> 16); \
+  } while (0)
+/* Size of the widest format's depth buffer element */
+#define DEPTH_MAX_SIZE sizeof(float)
+/*
+ * The frame and depth buffers are stored in 8x8 tiles (row major tiles of
+ * row major pixels), so nearby rows share cache lines, and are only made
+ * linear by renderer_resolve()
+ */
+#define TILE_SHIFT 3
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define TILE_MASK (TILE_SIZE - 1)
+#define TILE_PIXELS (TILE_SIZE * TILE_SIZE)
+/* Index of a pixel in the frame and depth buffers */
+#define PIXEL_INDEX(renderer, x, y) ( \
+    ((size_t)((y) >> TILE_SHIFT) * (renderer)->tiles_x + ((x) >> TILE_SHIFT)) \
+      * TILE_PIXELS \
+    + (((y) & TILE_MASK) << TILE_SHIFT) + ((x) & TILE_MASK) \
+)
+/*
+ * Pipeline state flags, or'd into renderer_t.pipeline. The raster loop is
+ * compiled once per combination of the raster flags, so the per pixel code
+ * never checks them.
+ */
+/* Interpolate vertex colours, otherwise use the first vertex's */
+#define PIPELINE_SMOOTH (1 << 0)
+#define PIPELINE_DEPTH_TEST (1 << 1)
+#define PIPELINE_DEPTH_WRITE (1 << 2)
+/* Flags handled by the raster loop, and its number of variants */
+#define PIPELINE_RASTER_MASK \
+  (PIPELINE_SMOOTH | PIPELINE_DEPTH_TEST | PIPELINE_DEPTH_WRITE)
+#define PIPELINE_RASTER_STATES (PIPELINE_RASTER_MASK + 1)
+/* Diffuse and ambient lighting, otherwise colours are drawn as they are */
+#define PIPELINE_LIGHTING (1 << 3)
+#define PIPELINE_DEFAULT (PIPELINE_RASTER_MASK | PIPELINE_LIGHTING)
+/* Kernel table (kernels.h) */
+struct kernels;
 /* Renderer struct */
 typedef struct {
   camera_t camera;
   uint32_t width, height;
+  uint32_t tiles_x, tiles_y;
   uint32_t *framebuffer;
-  float *depthbuffer;
+  /* Depth buffer, element type depends on depth_format */
+  depth_format_t depth_format;
+  void *depthbuffer;
+  /* Per-frame scratch memory, reset by renderer_clear() */
+  arena_t arena;
+  /* Workers every stage runs on, the renderer must not move once created */
+  jobs_t jobs;
+  /* Kernels for this cpu, picked in renderer_create() */
+  const struct kernels *kernels;
+  /* Mesh bounds caches */
+  mesh_cache_t *caches;
+  uint32_t num_caches;
+  /* Only pixels inside this are drawn */
+  rect_t scissor;
+  /* Pipeline state flags (PIPELINE_*), read once per draw */
+  uint32_t pipeline;
+  /* Last frame drawn by renderer_render() */
+  frame_state_t last_frame;
 } renderer_t;
 
-/* Create renderer */
-extern void renderer_create(
+/*
+ * Create renderer, with a number of worker threads (0 for one per cpu).
+ * Returns false if it couldn't start them, there's nothing to destroy then.
+ */
+extern bool renderer_create(
     renderer_t *renderer,
     uint32_t width,
-    uint32_t height
+    uint32_t height,
+    uint32_t threads
 );
 /* Destroy renderer */
 extern void renderer_destroy(renderer_t *renderer);
+/* Change the depth buffer format (clears the depth buffer) */
+extern void renderer_set_depth_format(
+    renderer_t *renderer,
+    depth_format_t format
+);
+/* Size of a depth format's buffer element */
+extern size_t depth_format_size(depth_format_t format);
+/* Write a depth format's clear value (behind everything) to an element */
+extern void depth_format_clear(depth_format_t format, void *element);
+/*
+ * Change the number of worker threads (0 for one per cpu). Returns false if
+ * they couldn't be started, the renderer is left with one worker then (or if
+ * even that failed none, and it can only be destroyed).
+ */
+extern bool renderer_set_threads(renderer_t *renderer, uint32_t threads);
+/* Drop the cached bounds of a mesh (call before freeing it) */
+extern void renderer_forget(renderer_t *renderer, const mesh_t *mesh);
 /* Resize renderer */
 extern void renderer_resize(
     renderer_t *renderer,
     uint32_t width,
     uint32_t height
 );
-/* Clear frame and depth buffer */
+/* Clear frame and depth buffer, starts a new frame */
 extern void renderer_clear(renderer_t *renderer);
+/* Copy the finished frame out in linear order, pitch is in bytes */
+extern void renderer_resolve(renderer_t *renderer, uint32_t *dst, size_t pitch);
+/*
+ * Render a frame of meshes, clearing first. Nothing is drawn if the camera,
+ * size and meshes (versions) are the same as last time, and only the screen
+ * rect of changed meshes is redrawn if the camera hasn't moved. Returns false
+ * if the framebuffer was left as it was.
+ */
+extern bool renderer_render(
+    renderer_t *renderer,
+    const mesh_t *const *meshes,
+    uint32_t num_meshes
+);
 /* Render mesh */
-extern void renderer_draw(renderer_t *renderer, mesh_t *mesh);
+extern void renderer_draw(renderer_t *renderer, const mesh_t *mesh);
+/* Render quantized mesh */
+extern void renderer_draw_quantized(
+    renderer_t *renderer,
+    const qmesh_t *qmesh
+);
+
+/*
+ * Quantize mesh (allocates, colours are clamped to 0-1), returns false if it
+ * couldn't allocate
+ */
+extern bool qmesh_create(qmesh_t *qmesh, const mesh_t *mesh);
+/* Destroy quantized mesh */
+extern void qmesh_destroy(qmesh_t *qmesh);
+/* Decode a quantized triangle back to a normal one */
+extern void qtri_decode(const qchunk_t *chunk, const qtri_t *qtri, tri_t *tri);
+/*
+ * Reorder a mesh's triangles for locality: chunks of nearby triangles (by the
+ * Morton code of their centroids, so chunk bounds are tight) each ordered for
+ * vertex reuse. Call once after loading, before quantizing. Returns false if
+ * it couldn't allocate scratch memory, leaving the mesh as it was.
+ */
+extern bool mesh_optimize(mesh_t *mesh);
+/* Model matrix of a mesh's translate, scale and rotate */
+extern m4x4_t model_matrix(vec3_t translate, vec3_t scale, vec3_t rotate);
+/* Unit face normal of a triangle */
+extern vec3_t tri_normal(const tri_t *tri);
+/*
+ * Work out a mesh's normals (allocates), call again after bumping its version.
+ * Returns false if it couldn't allocate, leaving them as they were.
+ */
+extern bool mesh_update_normals(mesh_t *mesh);
+/* Free a mesh's normals */
+extern void mesh_free_normals(mesh_t *mesh);
+
+/* Create a flat heightfield of width x depth cells (allocates) */
+extern bool heightfield_create(
+    heightfield_t *heightfield,
+    uint32_t width,
+    uint32_t depth,
+    bool colours
+);
+/* Destroy heightfield */
+extern void heightfield_destroy(heightfield_t *heightfield);
+/* Get the two triangles of a cell, in the heightfield's space */
+extern void heightfield_cell(
+    const heightfield_t *heightfield,
+    uint32_t x,
+    uint32_t z,
+    tri_t tris[2]
+);
 
 #endif /* RENDERER_H */
@@ -0,0 +1,112 @@
+/* Implements arena.h */
+#include <arena.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Round up to a multiple of a power of two */
+#define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~(size_t)((a) - 1))
+
+/* Overflow block header, in the first cache line of the block */
+typedef struct block {
+  struct block *next;
+  size_t size;
+} block_t;
+
+/* Allocate cache line aligned memory */
+static void *alloc_aligned(size_t size) {
+  return aligned_alloc(ARENA_ALIGN, ALIGN_UP(size ? size : 1, ARENA_ALIGN));
+}
+
+/* Create arena */
+void arena_create(arena_t *arena, size_t capacity) {
+  arena->capacity = ALIGN_UP(capacity, ARENA_GRANULE);
+  arena->base = alloc_aligned(arena->capacity);
+  /* Without a base every allocation takes the overflow path */
+  if (!arena->base) arena->capacity = 0;
+  arena->used = 0;
+  arena->overflow = NULL;
+  arena->overflow_used = 0;
+  arena->high_water = 0;
+  arena->peak = 0;
+  arena->last_frame = 0;
+  arena->grows = 0;
+}
+/* Destroy arena */
+void arena_destroy(arena_t *arena) {
+  arena_reset(arena);
+  free(arena->base);
+  arena->base = NULL;
+  arena->capacity = 0;
+}
+/* Allocate from arena, memory is valid until the next reset */
+void *arena_alloc(arena_t *arena, size_t size) {
+  size = ALIGN_UP(size, ARENA_ALIGN);
+  /* Count it before it can be trimmed, so the next frame has room for it */
+  size_t in_use = arena->used + arena->overflow_used + size;
+  if (in_use > arena->high_water) arena->high_water = in_use;
+  /* Fast path */
+  if (arena->used + size <= arena->capacity) {
+    void *ptr = arena->base + arena->used;
+    arena->used += size;
+    return ptr;
+  }
+  /* Out of space, give this allocation its own block */
+  block_t *block = alloc_aligned(ARENA_ALIGN + size);
+  if (!block) return NULL;
+  block->next = arena->overflow;
+  block->size = size;
+  arena->overflow = block;
+  arena->overflow_used += size;
+  return (uint8_t *)block + ARENA_ALIGN;
+}
+/* Shrink the last allocation to size bytes, returns where it is now */
+void *arena_trim(arena_t *arena, void *ptr, size_t size) {
+  size = ALIGN_UP(size, ARENA_ALIGN);
+  uint8_t *p = ptr;
+  /* From the main block, just move the end back */
+  if (arena->used && p >= arena->base && p < arena->base + arena->used) {
+    arena->used = (size_t)(p - arena->base) + size;
+    return ptr;
+  }
+  /* From the newest block, move it to a smaller one if there's memory */
+  block_t *block = arena->overflow;
+  if (!block || p != (uint8_t *)block + ARENA_ALIGN || size >= block->size) {
+    return ptr;
+  }
+  block_t *moved = alloc_aligned(ARENA_ALIGN + size);
+  if (!moved) return ptr;
+  memcpy((uint8_t *)moved + ARENA_ALIGN, p, size);
+  moved->next = block->next;
+  moved->size = size;
+  arena->overflow = moved;
+  arena->overflow_used -= block->size - size;
+  free(block);
+  return (uint8_t *)moved + ARENA_ALIGN;
+}
+/* Reset arena, call once per frame */
+void arena_reset(arena_t *arena) {
+  arena->last_frame = arena->high_water;
+  if (arena->high_water > arena->peak) arena->peak = arena->high_water;
+  /* Free overflow blocks (trimming may have left them empty) */
+  bool overflowed = arena->overflow != NULL;
+  while (arena->overflow) {
+    block_t *block = arena->overflow;
+    arena->overflow = block->next;
+    free(block);
+  }
+  /* Grow to the high-water mark if we overflowed, never shrinking */
+  size_t capacity = ALIGN_UP(arena->high_water, ARENA_GRANULE);
+  if (overflowed && capacity > arena->capacity) {
+    uint8_t *base = alloc_aligned(capacity);
+    if (base) {
+      free(arena->base);
+      arena->base = base;
+      arena->capacity = capacity;
+      arena->grows++;
+    }
+  }
+  arena->used = 0;
+  arena->overflow_used = 0;
+  arena->high_water = 0;
+}
@@ -0,0 +1,139 @@
+/* Implements batch.h */
+#define _POSIX_C_SOURCE 200809L
+#include <batch.h>
+#include <capture.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <threads.h>
+#include <unistd.h>
+
+/* Consts */
+#define LINE_LEN 512
+/* Frames each worker can have queued for its writer */
+#define CAPTURE_SLOTS 2
+
+/* State shared by the workers */
+typedef struct {
+  const batch_config_t *config;
+  const batch_pose_t *poses;
+  uint32_t num_poses;
+  const mesh_t *mesh;
+  atomic_uint next;
+  atomic_uint written;
+} batch_t;
+
+/* Worker thread, renders poses until there are none left */
+static int batch_worker(void *arg) {
+  batch_t *batch = arg;
+  const batch_config_t *config = batch->config;
+  renderer_t renderer;
+  capture_t capture;
+  capture_config_t capture_config = {
+    .format = capture_guess_format(config->output),
+    .path = config->output,
+    .slots = CAPTURE_SLOTS,
+    .block = true,
+  };
+  if (!capture_create(&capture, &capture_config, config->width,
+        config->height)) {
+    return 1;
+  }
+  /* Views are already spread over threads, don't split them up further */
+  if (!renderer_create(&renderer, config->width, config->height, 1)) {
+    capture_destroy(&capture);
+    return 1;
+  }
+
+  for (;;) {
+    uint32_t i = atomic_fetch_add(&batch->next, 1);
+    if (i >= batch->num_poses) break;
+    renderer.camera.pos = batch->poses[i].pos;
+    renderer.camera.pitch = batch->poses[i].pitch;
+    renderer.camera.yaw = batch->poses[i].yaw;
+    renderer.camera.fov = batch->poses[i].fov;
+    renderer_clear(&renderer);
+    renderer_draw(&renderer, batch->mesh);
+    capture_frame_numbered(&capture, &renderer, i);
+  }
+
+  capture_destroy(&capture);
+  renderer_destroy(&renderer);
+  atomic_fetch_add(&batch->written, (unsigned)capture.written);
+  return 0;
+}
+
+/* Load poses from a file */
+batch_pose_t *batch_load_poses(const char *path, uint32_t *count) {
+  FILE *fp = fopen(path, "r");
+  if (!fp) return NULL;
+  uint32_t capacity = 64;
+  batch_pose_t *poses = malloc(capacity * sizeof(batch_pose_t));
+  char line[LINE_LEN];
+  *count = 0;
+  while (poses && fgets(line, sizeof(line), fp)) {
+    batch_pose_t pose;
+    if (line[0] == '#') continue;
+    if (sscanf(
+          line,
+          "%f %f %f %f %f %f",
+          &pose.pos.x, &pose.pos.y, &pose.pos.z,
+          &pose.pitch, &pose.yaw, &pose.fov
+        ) != 6) {
+      continue;
+    }
+    if (*count == capacity) {
+      capacity *= 2;
+      batch_pose_t *grown = realloc(poses, capacity * sizeof(batch_pose_t));
+      if (!grown) free(poses);
+      poses = grown;
+      if (!poses) break;
+    }
+    poses[(*count)++] = pose;
+  }
+  fclose(fp);
+  return poses;
+}
+/* Render every pose of a mesh */
+uint32_t batch_render(
+    const batch_config_t *config,
+    const batch_pose_t *poses,
+    uint32_t num_poses,
+    const mesh_t *mesh
+) {
+  capture_format_t format = capture_guess_format(config->output);
+  if (format != CAPTURE_PPM && format != CAPTURE_PNG) {
+    fprintf(stderr, "batch output must be a .png or .ppm pattern\n");
+    return 0;
+  }
+  uint32_t num_threads = config->threads;
+  if (!num_threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = cpus > 0 ? (uint32_t)cpus : 1;
+  }
+  if (num_threads > num_poses) num_threads = num_poses ? num_poses : 1;
+
+  batch_t batch = {
+    .config = config,
+    .poses = poses,
+    .num_poses = num_poses,
+    .mesh = mesh,
+  };
+  atomic_init(&batch.next, 0);
+  atomic_init(&batch.written, 0);
+  thrd_t *threads = malloc(num_threads * sizeof(thrd_t));
+  if (!threads) return 0;
+  uint32_t started = 0;
+  for (; started < num_threads; started++) {
+    if (thrd_create(&threads[started], batch_worker, &batch) != thrd_success) {
+      break;
+    }
+  }
+  /* Render on this thread too if we couldn't start any */
+  if (!started) batch_worker(&batch);
+  for (uint32_t i = 0; i < started; i++) {
+    thrd_join(threads[i], NULL);
+  }
+  free(threads);
+  return atomic_load(&batch.written);
+}
@@ -0,0 +1,438 @@
+/* Implements capture.h */
+#define _POSIX_C_SOURCE 200809L
+#include <capture.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Consts */
+#define PATH_LEN 4096
+/* Biggest stored deflate block */
+#define DEFLATE_BLOCK 65535
+
+/* Get r, g, b from a framebuffer pixel */
+#define PIX_R(p) (((p) >> 24) & 0xFF)
+#define PIX_G(p) (((p) >> 16) & 0xFF)
+#define PIX_B(p) (((p) >> 8) & 0xFF)
+
+/* CRC32 table for png chunks */
+static uint32_t crc_table[256];
+static once_flag crc_once = ONCE_FLAG_INIT;
+static void crc_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+    crc_table[i] = c;
+  }
+}
+/* Update a CRC32 */
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+/* Write big endian u32 */
+static void put_u32(uint8_t *dst, uint32_t v) {
+  dst[0] = v >> 24;
+  dst[1] = v >> 16;
+  dst[2] = v >> 8;
+  dst[3] = v;
+}
+/* Write a png chunk, data must have 8 free bytes before it */
+static bool write_png_chunk(
+    FILE *fp,
+    const char *type,
+    uint8_t *data,
+    uint32_t len
+) {
+  uint8_t tail[4];
+  put_u32(data - 8, len);
+  memcpy(data - 4, type, 4);
+  put_u32(tail, crc32(0, data - 4, len + 4));
+  return fwrite(data - 8, 1, len + 8, fp) == len + 8
+    && fwrite(tail, 1, 4, fp) == 4;
+}
+
+/* Write a frame as ppm */
+static bool write_ppm(capture_t *capture, FILE *fp, const uint32_t *frame) {
+  size_t count = (size_t)capture->width * capture->height;
+  uint8_t *out = capture->scratch;
+  for (size_t i = 0; i < count; i++) {
+    *out++ = PIX_R(frame[i]);
+    *out++ = PIX_G(frame[i]);
+    *out++ = PIX_B(frame[i]);
+  }
+  fprintf(fp, "P6\n%u %u\n255\n", capture->width, capture->height);
+  return fwrite(capture->scratch, 3, count, fp) == count;
+}
+/* Write a frame as png, uncompressed (stored deflate blocks) */
+static bool write_png(capture_t *capture, FILE *fp, const uint32_t *frame) {
+  static const uint8_t signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+  uint8_t header[8 + 13];
+  uint8_t end[8];
+  size_t row = 1 + (size_t)capture->width * 3;
+  size_t raw_len = row * capture->height;
+  uint8_t *raw = capture->scratch;
+  /* Filter type 0 + rgb for every row */
+  for (uint32_t y = 0; y < capture->height; y++) {
+    uint8_t *out = raw + y * row;
+    *out++ = 0;
+    for (uint32_t x = 0; x < capture->width; x++) {
+      uint32_t p = frame[y * capture->width + x];
+      *out++ = PIX_R(p);
+      *out++ = PIX_G(p);
+      *out++ = PIX_B(p);
+    }
+  }
+  /* Wrap in a zlib stream, after the raw data with room for chunk headers */
+  uint8_t *idat = raw + raw_len + 8;
+  uint8_t *out = idat;
+  uint32_t a = 1, b = 0;
+  *out++ = 0x78;
+  *out++ = 0x01;
+  for (size_t i = 0; i < raw_len || i == 0; i += DEFLATE_BLOCK) {
+    size_t len = raw_len - i < DEFLATE_BLOCK ? raw_len - i : DEFLATE_BLOCK;
+    *out++ = i + len >= raw_len;
+    *out++ = len & 0xFF;
+    *out++ = len >> 8;
+    *out++ = ~len & 0xFF;
+    *out++ = (~len >> 8) & 0xFF;
+    memcpy(out, raw + i, len);
+    out += len;
+    for (size_t j = 0; j < len; j++) {
+      a = (a + raw[i + j]) % 65521;
+      b = (b + a) % 65521;
+    }
+  }
+  put_u32(out, b << 16 | a);
+  out += 4;
+  /* Write */
+  put_u32(header + 8, capture->width);
+  put_u32(header + 12, capture->height);
+  header[16] = 8;
+  header[17] = 2;
+  header[18] = 0;
+  header[19] = 0;
+  header[20] = 0;
+  return fwrite(signature, 1, 8, fp) == 8
+    && write_png_chunk(fp, "IHDR", header + 8, 13)
+    && write_png_chunk(fp, "IDAT", idat, out - idat)
+    && write_png_chunk(fp, "IEND", end + 8, 0);
+}
+/* Write a frame to a y4m stream (4:4:4, bt.601) */
+static bool write_y4m(capture_t *capture, FILE *fp, const uint32_t *frame) {
+  size_t count = (size_t)capture->width * capture->height;
+  uint8_t *y_plane = capture->scratch;
+  uint8_t *u_plane = y_plane + count;
+  uint8_t *v_plane = u_plane + count;
+  for (size_t i = 0; i < count; i++) {
+    int r = PIX_R(frame[i]);
+    int g = PIX_G(frame[i]);
+    int b = PIX_B(frame[i]);
+    y_plane[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    u_plane[i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    v_plane[i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+  }
+  fputs("FRAME\n", fp);
+  return fwrite(capture->scratch, 3, count, fp) == count;
+}
+/* Write a frame to a raw rgba stream */
+static bool write_rgba(capture_t *capture, FILE *fp, const uint32_t *frame) {
+  size_t count = (size_t)capture->width * capture->height;
+  uint8_t *out = capture->scratch;
+  for (size_t i = 0; i < count; i++) {
+    *out++ = PIX_R(frame[i]);
+    *out++ = PIX_G(frame[i]);
+    *out++ = PIX_B(frame[i]);
+    *out++ = 255;
+  }
+  return fwrite(capture->scratch, 4, count, fp) == count;
+}
+/*
+ * Expand a sequence path pattern for a frame number: "%u" or "%0Nu" is the
+ * number and "%%" a literal '%'. The path is never used as a printf format.
+ * Returns the number of conversions, -1 if the pattern has any other or the
+ * result doesn't fit.
+ */
+static int expand_path(
+    const char *pattern,
+    uint64_t number,
+    char *path,
+    size_t size
+) {
+  int conversions = 0;
+  size_t len = 0;
+  for (const char *c = pattern; *c; c++) {
+    char digits[32];
+    const char *text = c;
+    size_t n = 1;
+    if (*c == '%') {
+      c++;
+      if (*c == '%') {
+        text = c;
+      } else {
+        int width = 0;
+        if (*c == '0') {
+          while (*++c >= '0' && *c <= '9') {
+            width = width * 10 + (*c - '0');
+            if (width > 20) return -1;
+          }
+        }
+        if (*c != 'u') return -1;
+        snprintf(
+            digits, sizeof(digits), "%0*llu",
+            width, (unsigned long long)number
+        );
+        text = digits;
+        n = strlen(digits);
+        conversions++;
+      }
+    }
+    if (len + n >= size) return -1;
+    memcpy(path + len, text, n);
+    len += n;
+  }
+  path[len] = '\0';
+  return conversions;
+}
+/* Write one frame */
+static bool write_frame(
+    capture_t *capture,
+    const uint32_t *frame,
+    uint64_t number
+) {
+  bool ok;
+  switch (capture->config.format) {
+    case CAPTURE_PPM:
+    case CAPTURE_PNG: {
+      char path[PATH_LEN];
+      if (expand_path(capture->path, number, path, sizeof(path)) != 1) {
+        return false;
+      }
+      FILE *fp = fopen(path, "wb");
+      if (!fp) return false;
+      ok = capture->config.format == CAPTURE_PPM
+        ? write_ppm(capture, fp, frame)
+        : write_png(capture, fp, frame);
+      return fclose(fp) == 0 && ok;
+    }
+    case CAPTURE_Y4M:
+      return write_y4m(capture, capture->stream, frame);
+    case CAPTURE_RGBA:
+      return write_rgba(capture, capture->stream, frame);
+  }
+  return false;
+}
+
+/* Writer thread */
+static int writer_thread(void *arg) {
+  capture_t *capture = arg;
+  mtx_lock(&capture->lock);
+  for (;;) {
+    while (!capture->count && !capture->stopping) {
+      cnd_wait(&capture->not_empty, &capture->lock);
+    }
+    if (!capture->count) break;
+    uint32_t slot = capture->head;
+    mtx_unlock(&capture->lock);
+
+    bool ok = !capture->failed && write_frame(
+        capture,
+        capture->frames[slot],
+        capture->frame_numbers[slot]
+    );
+
+    mtx_lock(&capture->lock);
+    /* After a failure the rest of the queue is dropped too */
+    if (ok) {
+      capture->written++;
+    } else {
+      capture->failed = true;
+      capture->dropped++;
+    }
+    capture->head = (capture->head + 1) % capture->config.slots;
+    capture->count--;
+    cnd_signal(&capture->not_full);
+  }
+  mtx_unlock(&capture->lock);
+  if (capture->stream) fflush(capture->stream);
+  return 0;
+}
+
+/* Open the output stream, for stream formats */
+static bool open_stream(capture_t *capture) {
+  if (!strcmp(capture->path, "-")) {
+    capture->stream = stdout;
+  } else if (capture->path[0] == '|') {
+    capture->stream = popen(capture->path + 1, "w");
+    capture->pipe = true;
+  } else {
+    capture->stream = fopen(capture->path, "wb");
+  }
+  if (!capture->stream) return false;
+  if (capture->config.format == CAPTURE_Y4M) {
+    fprintf(
+        capture->stream,
+        "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444\n",
+        capture->width,
+        capture->height,
+        capture->config.fps ? capture->config.fps : 60
+    );
+  }
+  return true;
+}
+/* Close the output stream */
+static void close_stream(capture_t *capture) {
+  if (!capture->stream) return;
+  if (capture->pipe) pclose(capture->stream);
+  else if (capture->stream != stdout) fclose(capture->stream);
+  else fflush(stdout);
+  capture->stream = NULL;
+}
+
+/* Guess the format from a path's extension (raw rgba if unknown) */
+capture_format_t capture_guess_format(const char *path) {
+  const char *ext = strrchr(path, '.');
+  if (!ext) return CAPTURE_RGBA;
+  if (!strcmp(ext, ".ppm")) return CAPTURE_PPM;
+  if (!strcmp(ext, ".png")) return CAPTURE_PNG;
+  if (!strcmp(ext, ".y4m")) return CAPTURE_Y4M;
+  return CAPTURE_RGBA;
+}
+/* Start capturing frames of the given size, returns false on failure */
+bool capture_create(
+    capture_t *capture,
+    const capture_config_t *config,
+    uint32_t width,
+    uint32_t height
+) {
+  memset(capture, 0, sizeof(*capture));
+  capture->config = *config;
+  if (!capture->config.slots) capture->config.slots = 1;
+  capture->width = width;
+  capture->height = height;
+  call_once(&crc_once, crc_init);
+  if (config->format == CAPTURE_PPM || config->format == CAPTURE_PNG) {
+    char path[PATH_LEN];
+    if (expand_path(config->path, 0, path, sizeof(path)) != 1) {
+      fprintf(
+          stderr,
+          "capture path %s needs exactly one %%u or %%0Nu for the frame "
+          "number\n",
+          config->path
+      );
+      return false;
+    }
+  }
+
+  /* Copy the path, the config's may not outlive us */
+  size_t path_len = strlen(config->path) + 1;
+  capture->path = malloc(path_len);
+  if (!capture->path) return false;
+  memcpy(capture->path, config->path, path_len);
+  if (config->format == CAPTURE_Y4M || config->format == CAPTURE_RGBA) {
+    if (!open_stream(capture)) {
+      free(capture->path);
+      return false;
+    }
+  }
+
+  /* Frame ring and writer scratch (big enough for png with headers) */
+  size_t count = (size_t)width * height;
+  capture->frames = calloc(capture->config.slots, sizeof(uint32_t *));
+  capture->frame_numbers = calloc(capture->config.slots, sizeof(uint64_t));
+  for (uint32_t i = 0; capture->frames && i < capture->config.slots; i++) {
+    capture->frames[i] = malloc(count * sizeof(uint32_t));
+  }
+  size_t png_raw = (1 + (size_t)width * 3) * height;
+  capture->scratch = malloc(
+      2 * png_raw + 5 * (png_raw / DEFLATE_BLOCK + 1) + 64
+  );
+  mtx_init(&capture->lock, mtx_plain);
+  cnd_init(&capture->not_empty);
+  cnd_init(&capture->not_full);
+  bool ok = capture->frames && capture->frame_numbers && capture->scratch;
+  for (uint32_t i = 0; ok && i < capture->config.slots; i++) {
+    ok = capture->frames[i];
+  }
+  if (!ok || thrd_create(&capture->writer, writer_thread, capture)
+      != thrd_success) {
+    capture->stopping = true;
+    capture_destroy(capture);
+    return false;
+  }
+  return true;
+}
+/* Finish writing queued frames and stop */
+void capture_destroy(capture_t *capture) {
+  mtx_lock(&capture->lock);
+  bool running = !capture->stopping;
+  capture->stopping = true;
+  cnd_signal(&capture->not_empty);
+  mtx_unlock(&capture->lock);
+  if (running) thrd_join(capture->writer, NULL);
+
+  close_stream(capture);
+  for (uint32_t i = 0; capture->frames && i < capture->config.slots; i++) {
+    free(capture->frames[i]);
+  }
+  free(capture->frames);
+  free(capture->frame_numbers);
+  free(capture->scratch);
+  free(capture->path);
+  cnd_destroy(&capture->not_full);
+  cnd_destroy(&capture->not_empty);
+  mtx_destroy(&capture->lock);
+}
+/*
+ * Queue the renderer's current frame, returns false if it was dropped (writer
+ * behind or failed, or the renderer is not the capture's size)
+ */
+bool capture_frame(capture_t *capture, renderer_t *renderer) {
+  return capture_frame_numbered(capture, renderer, capture->submitted);
+}
+/* Same as capture_frame(), but with an explicit frame number for sequences */
+bool capture_frame_numbered(
+    capture_t *capture,
+    renderer_t *renderer,
+    uint64_t number
+) {
+  capture->submitted++;
+  mtx_lock(&capture->lock);
+  if (renderer->width != capture->width
+      || renderer->height != capture->height) {
+    capture->dropped++;
+    mtx_unlock(&capture->lock);
+    return false;
+  }
+
+  /* Get a free slot */
+  if (capture->config.block) {
+    while (capture->count == capture->config.slots && !capture->failed) {
+      cnd_wait(&capture->not_full, &capture->lock);
+    }
+  }
+  if (capture->count == capture->config.slots || capture->failed) {
+    capture->dropped++;
+    mtx_unlock(&capture->lock);
+    return false;
+  }
+  uint32_t slot = capture->tail;
+  mtx_unlock(&capture->lock);
+
+  /* The writer never touches slots past head + count, so copy unlocked */
+  renderer_resolve(
+      renderer,
+      capture->frames[slot],
+      capture->width * sizeof(uint32_t)
+  );
+  capture->frame_numbers[slot] = number;
+
+  mtx_lock(&capture->lock);
+  capture->tail = (capture->tail + 1) % capture->config.slots;
+  capture->count++;
+  cnd_signal(&capture->not_empty);
+  mtx_unlock(&capture->lock);
+  return true;
+}
@@ -0,0 +1,351 @@
+/* Implements distrib.h */
+/* For MAP_ANONYMOUS, on top of POSIX */
+#define _DEFAULT_SOURCE
+#include <distrib.h>
+#include <capture.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* Consts */
+/* Frames the compositing process can have queued for its writer */
+#define CAPTURE_SLOTS 2
+
+/*
+ * One renderer process:
+ * - the frame is cut into one stripe of tile rows per process, each process
+ *   composites its own stripe
+ * - shared memory has a slot per (sender, stripe) for the sender's part of
+ *   that stripe, holding only the tiles it drew anything in, and the
+ *   composited frame
+ * - rank 0 has a socket to every other process, the others one to rank 0,
+ *   only used to wait for each other
+ */
+typedef struct {
+  uint32_t rank, ranks;
+  int sockets[DISTRIB_MAX_PROCESSES];
+  uint8_t *shared;
+  size_t slot_size;
+  uint32_t stripe_rows;
+  uint32_t *frame;
+  renderer_t renderer;
+  /* A tile of the depth format's clear value */
+  uint8_t clear_tile[TILE_PIXELS * DEPTH_MAX_SIZE];
+} node_t;
+
+/* Wait for every process to get here, false if one of them is gone */
+static bool barrier(const node_t *node) {
+  char token = 0;
+  if (node->rank) {
+    return send(node->sockets[0], &token, 1, MSG_NOSIGNAL) == 1
+      && recv(node->sockets[0], &token, 1, 0) == 1;
+  }
+  for (uint32_t r = 1; r < node->ranks; r++) {
+    if (recv(node->sockets[r], &token, 1, 0) != 1) return false;
+  }
+  for (uint32_t r = 1; r < node->ranks; r++) {
+    if (send(node->sockets[r], &token, 1, MSG_NOSIGNAL) != 1) return false;
+  }
+  return true;
+}
+/* Tiles [first, first + count) of a stripe */
+static void stripe_tiles(
+    const node_t *node,
+    uint32_t stripe,
+    size_t *first,
+    size_t *count
+) {
+  const renderer_t *renderer = &node->renderer;
+  uint32_t y0 = stripe * node->stripe_rows;
+  uint32_t y1 = y0 + node->stripe_rows;
+  if (y0 > renderer->tiles_y) y0 = renderer->tiles_y;
+  if (y1 > renderer->tiles_y) y1 = renderer->tiles_y;
+  *first = (size_t)y0 * renderer->tiles_x;
+  *count = (size_t)(y1 - y0) * renderer->tiles_x;
+}
+/*
+ * Slot a sender's part of a stripe goes in: the number of tiles, their
+ * indices in the stripe, then their colours and depths
+ */
+static uint32_t *slot(const node_t *node, uint32_t sender, uint32_t stripe) {
+  return (uint32_t *)(node->shared
+      + (sender * node->ranks + stripe) * node->slot_size);
+}
+/* True if nothing was drawn in a tile, its depth is all the clear value */
+static bool tile_empty(const node_t *node, size_t tile) {
+  const renderer_t *renderer = &node->renderer;
+  size_t size = depth_format_size(renderer->depth_format) * TILE_PIXELS;
+  const uint8_t *depth = (const uint8_t *)renderer->depthbuffer + tile * size;
+  return !memcmp(depth, node->clear_tile, size);
+}
+/* Copy our part of a stripe to its slot, skipping empty tiles */
+static void pack(node_t *node, uint32_t stripe) {
+  const renderer_t *renderer = &node->renderer;
+  size_t first, count;
+  stripe_tiles(node, stripe, &first, &count);
+  size_t max_tiles = (size_t)node->stripe_rows * renderer->tiles_x;
+  size_t size = depth_format_size(renderer->depth_format) * TILE_PIXELS;
+  uint32_t *out = slot(node, node->rank, stripe);
+  uint32_t *indices = out + 1;
+  uint32_t *colours = indices + max_tiles;
+  uint8_t *depths = (uint8_t *)(colours + max_tiles * TILE_PIXELS);
+  uint32_t n = 0;
+  for (size_t t = 0; t < count; t++) {
+    if (tile_empty(node, first + t)) continue;
+    indices[n] = (uint32_t)t;
+    memcpy(
+        colours + n * TILE_PIXELS,
+        renderer->framebuffer + (first + t) * TILE_PIXELS,
+        TILE_PIXELS * sizeof(uint32_t)
+    );
+    memcpy(
+        depths + n * size,
+        (const uint8_t *)renderer->depthbuffer + (first + t) * size,
+        size
+    );
+    n++;
+  }
+  out[0] = n;
+}
+/* Read a depth element that's stored as it is */
+#define DEPTH_READ(d) (*(d))
+/* Depth test a packed tile into a tile of ours, reading depths with load */
+#define MERGE_TILE(type, load, closer) { \
+    const type *src = (const type *)src_depth; \
+    type *dst = (type *)dst_depth; \
+    for (uint32_t p = 0; p < TILE_PIXELS; p++) { \
+      if (load(&src[p]) closer load(&dst[p])) { \
+        dst[p] = src[p]; \
+        dst_colour[p] = src_colour[p]; \
+      } \
+    } \
+  }
+/* Depth test a sender's part of our stripe into our buffers */
+static void merge(node_t *node, uint32_t sender) {
+  renderer_t *renderer = &node->renderer;
+  size_t first, count;
+  stripe_tiles(node, node->rank, &first, &count);
+  size_t max_tiles = (size_t)node->stripe_rows * renderer->tiles_x;
+  size_t size = depth_format_size(renderer->depth_format) * TILE_PIXELS;
+  const uint32_t *in = slot(node, sender, node->rank);
+  const uint32_t *indices = in + 1;
+  const uint32_t *colours = indices + max_tiles;
+  const uint8_t *depths =
+    (const uint8_t *)(colours + max_tiles * TILE_PIXELS);
+  for (uint32_t n = 0; n < in[0]; n++) {
+    size_t tile = first + indices[n];
+    const uint32_t *src_colour = colours + n * TILE_PIXELS;
+    const uint8_t *src_depth = depths + n * size;
+    uint32_t *dst_colour = renderer->framebuffer + tile * TILE_PIXELS;
+    uint8_t *dst_depth = (uint8_t *)renderer->depthbuffer + tile * size;
+    switch (renderer->depth_format) {
+      case DEPTH_F32_REVERSED: MERGE_TILE(float, DEPTH_READ, >) break;
+      case DEPTH_UNORM16: MERGE_TILE(uint16_t, DEPTH_READ, <) break;
+      case DEPTH_UNORM24: MERGE_TILE(depth24_t, DEPTH24_LOAD, <) break;
+      default: MERGE_TILE(float, DEPTH_READ, <) break;
+    }
+  }
+}
+#undef MERGE_TILE
+#undef DEPTH_READ
+
+/* Render and composite every pose, returns false if a process went away */
+static bool node_run(
+    node_t *node,
+    const batch_pose_t *poses,
+    uint32_t num_poses,
+    const mesh_t *share,
+    capture_t *capture
+) {
+  renderer_t *renderer = &node->renderer;
+  size_t frame_size =
+    (size_t)renderer->tiles_x * renderer->tiles_y * TILE_PIXELS;
+  for (uint32_t i = 0; i < num_poses; i++) {
+    renderer->camera.pos = poses[i].pos;
+    renderer->camera.pitch = poses[i].pitch;
+    renderer->camera.yaw = poses[i].yaw;
+    renderer->camera.fov = poses[i].fov;
+    renderer_clear(renderer);
+    renderer_draw(renderer, share);
+    /* Direct send: hand every other stripe to the process compositing it */
+    for (uint32_t stripe = 0; stripe < node->ranks; stripe++) {
+      if (stripe != node->rank) pack(node, stripe);
+    }
+    if (!barrier(node)) return false;
+    for (uint32_t sender = 0; sender < node->ranks; sender++) {
+      if (sender != node->rank) merge(node, sender);
+    }
+    size_t first, count;
+    stripe_tiles(node, node->rank, &first, &count);
+    memcpy(
+        node->frame + first * TILE_PIXELS,
+        renderer->framebuffer + first * TILE_PIXELS,
+        count * TILE_PIXELS * sizeof(uint32_t)
+    );
+    /* Slots can be reused and the frame is whole once everyone is done */
+    if (!barrier(node)) return false;
+    if (capture) {
+      memcpy(
+          renderer->framebuffer,
+          node->frame,
+          frame_size * sizeof(uint32_t)
+      );
+      capture_frame_numbered(capture, renderer, i);
+    }
+  }
+  return true;
+}
+/* Set up a process's renderer and share of the mesh, then run it */
+static bool node_main(
+    node_t *node,
+    const distrib_config_t *config,
+    const batch_pose_t *poses,
+    uint32_t num_poses,
+    const mesh_t *mesh,
+    capture_t *capture
+) {
+  mesh_t share;
+  heightfield_t share_field;
+  distrib_share(mesh, node->rank, node->ranks, &share, &share_field);
+  /* The cpus are already split between processes */
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t threads = cpus > node->ranks ? (uint32_t)cpus / node->ranks : 1;
+  if (!renderer_create(&node->renderer, config->width, config->height,
+        threads)) {
+    return false;
+  }
+  depth_format_t format = node->renderer.depth_format;
+  size_t size = depth_format_size(format);
+  for (uint32_t p = 0; p < TILE_PIXELS; p++) {
+    depth_format_clear(format, node->clear_tile + p * size);
+  }
+  bool ok = node_run(node, poses, num_poses, &share, capture);
+  renderer_destroy(&node->renderer);
+  return ok;
+}
+
+/* Split a mesh into its share for one of a number of processes */
+void distrib_share(
+    const mesh_t *mesh,
+    uint32_t rank,
+    uint32_t ranks,
+    mesh_t *share,
+    heightfield_t *share_field
+) {
+  *share = *mesh;
+  if (mesh->heightfield) {
+    const heightfield_t *field = mesh->heightfield;
+    uint32_t z0 = (uint32_t)((uint64_t)field->depth * rank / ranks);
+    uint32_t z1 = (uint32_t)((uint64_t)field->depth * (rank + 1) / ranks);
+    size_t offset = (size_t)z0 * (field->width + 1);
+    *share_field = (heightfield_t){
+      .width = field->width,
+      .depth = z1 - z0,
+      .heights = field->heights + offset,
+      .colours = field->colours ? field->colours + offset : NULL,
+    };
+    /* Move the rows back to where they were in the mesh's space */
+    m4x4_t model = model_matrix(mesh->translate, mesh->scale, mesh->rotate);
+    vec4_t origin = m4x4v4_mul(model, V4_FROM(0, 0, (float)z0, 1));
+    share->translate = V3_FROM(origin.x, origin.y, origin.z);
+    share->heightfield = share_field;
+    return;
+  }
+  uint32_t first = (uint32_t)((uint64_t)mesh->num_tris * rank / ranks);
+  uint32_t last = (uint32_t)((uint64_t)mesh->num_tris * (rank + 1) / ranks);
+  share->tris = mesh->tris + first;
+  share->num_tris = last - first;
+  if (mesh->normals) share->normals = mesh->normals + first;
+}
+/* Render every pose of a mesh with it split over forked processes */
+uint32_t distrib_render(
+    const distrib_config_t *config,
+    const batch_pose_t *poses,
+    uint32_t num_poses,
+    const mesh_t *mesh
+) {
+  capture_format_t format = capture_guess_format(config->output);
+  if (format != CAPTURE_PPM && format != CAPTURE_PNG) {
+    fprintf(stderr, "distributed output must be a .png or .ppm pattern\n");
+    return 0;
+  }
+  node_t node = { .rank = 0, .ranks = config->processes };
+  if (node.ranks < 1) node.ranks = 1;
+  if (node.ranks > DISTRIB_MAX_PROCESSES) node.ranks = DISTRIB_MAX_PROCESSES;
+
+  /* Shared memory, set up before forking so every process maps it */
+  uint32_t tiles_x = (config->width + TILE_MASK) >> TILE_SHIFT;
+  uint32_t tiles_y = (config->height + TILE_MASK) >> TILE_SHIFT;
+  node.stripe_rows = (tiles_y + node.ranks - 1) / node.ranks;
+  size_t max_tiles = (size_t)node.stripe_rows * tiles_x;
+  node.slot_size = sizeof(uint32_t) * (1 + max_tiles)
+    + max_tiles * TILE_PIXELS * (sizeof(uint32_t) + DEPTH_MAX_SIZE);
+  node.slot_size = (node.slot_size + 63) & ~(size_t)63;
+  size_t frame_size = (size_t)tiles_x * tiles_y * TILE_PIXELS;
+  size_t shared_size = node.slot_size * node.ranks * node.ranks
+    + frame_size * sizeof(uint32_t);
+  node.shared = mmap(
+      NULL, shared_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0
+  );
+  if (node.shared == MAP_FAILED) return 0;
+  node.frame =
+    (uint32_t *)(node.shared + node.slot_size * node.ranks * node.ranks);
+
+  /* Start the other processes, stopping them all if any fail to start */
+  pid_t pids[DISTRIB_MAX_PROCESSES];
+  uint32_t started = 1;
+  for (; started < node.ranks; started++) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair)) break;
+    pid_t pid = fork();
+    if (pid < 0) {
+      close(pair[0]);
+      close(pair[1]);
+      break;
+    }
+    if (!pid) {
+      /* Only keep our end of our own socket */
+      for (uint32_t r = 1; r < started; r++) close(node.sockets[r]);
+      close(pair[0]);
+      node.rank = started;
+      node.sockets[0] = pair[1];
+      bool ok = node_main(&node, config, poses, num_poses, mesh, NULL);
+      _exit(ok ? 0 : 1);
+    }
+    close(pair[1]);
+    node.sockets[started] = pair[0];
+    pids[started] = pid;
+  }
+
+  uint32_t written = 0;
+  if (started == node.ranks) {
+    capture_t capture;
+    capture_config_t capture_config = {
+      .format = format,
+      .path = config->output,
+      .slots = CAPTURE_SLOTS,
+      .block = true,
+    };
+    if (capture_create(&capture, &capture_config, config->width,
+          config->height)) {
+      node_main(&node, config, poses, num_poses, mesh, &capture);
+      capture_destroy(&capture);
+      written = (uint32_t)capture.written;
+    }
+  } else {
+    fprintf(stderr, "couldn't start %u renderer processes\n", node.ranks);
+  }
+  /* Closing the sockets stops any process still waiting on us */
+  for (uint32_t r = 1; r < started; r++) {
+    close(node.sockets[r]);
+    waitpid(pids[r], NULL, 0);
+  }
+  munmap(node.shared, shared_size);
+  return written;
+}
@@ -0,0 +1,62 @@
+/* Implements the heightfield part of renderer.h */
+#include <renderer.h>
+#include <stdlib.h>
+
+/* Create a flat heightfield of width x depth cells (allocates) */
+bool heightfield_create(
+    heightfield_t *heightfield,
+    uint32_t width,
+    uint32_t depth,
+    bool colours
+) {
+  size_t count = (size_t)(width + 1) * (depth + 1);
+  heightfield->width = width;
+  heightfield->depth = depth;
+  heightfield->heights = calloc(count, sizeof(float));
+  heightfield->colours = colours ? calloc(count, sizeof(vec3_t)) : NULL;
+  if (!heightfield->heights || (colours && !heightfield->colours)) {
+    heightfield_destroy(heightfield);
+    return false;
+  }
+  return true;
+}
+/* Destroy heightfield */
+void heightfield_destroy(heightfield_t *heightfield) {
+  free(heightfield->heights);
+  free(heightfield->colours);
+  heightfield->heights = NULL;
+  heightfield->colours = NULL;
+}
+/* Get the two triangles of a cell, in the heightfield's space */
+void heightfield_cell(
+    const heightfield_t *heightfield,
+    uint32_t x,
+    uint32_t z,
+    tri_t tris[2]
+) {
+  /* Corners, 0 at (x, z) then anticlockwise from above: +z, +x+z, +x */
+  size_t pitch = heightfield->width + 1;
+  size_t i[4] = {
+    z * pitch + x,
+    (z + 1) * pitch + x,
+    (z + 1) * pitch + x + 1,
+    z * pitch + x + 1,
+  };
+  vec3_t points[4];
+  vec3_t cols[4];
+  for (uint32_t c = 0; c < 4; c++) {
+    float h = heightfield->heights[i[c]];
+    points[c] = V3_FROM(x + (c >= 2), h, z + (c == 1 || c == 2));
+    cols[c] = heightfield->colours
+      ? heightfield->colours[i[c]]
+      : V3_FROM(h, h, h);
+  }
+  tris[0] = (tri_t){
+    .points = { points[0], points[1], points[2] },
+    .cols = { cols[0], cols[1], cols[2] },
+  };
+  tris[1] = (tri_t){
+    .points = { points[2], points[3], points[0] },
+    .cols = { cols[2], cols[3], cols[0] },
+  };
+}
@@ -0,0 +1,221 @@
+/* Implements jobs.h */
+#define _POSIX_C_SOURCE 200809L
+#include <jobs.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Scheduler and worker index of the current thread, if it's a worker */
+static thread_local struct {
+  const jobs_t *jobs;
+  uint32_t index;
+} current;
+
+/* Index of the calling thread's worker, outside threads act as worker 0 */
+static uint32_t self(const jobs_t *jobs) {
+  return current.jobs == jobs ? current.index : 0;
+}
+/* Push a job at the bottom of a worker's queue, false if it's full */
+static bool push(jobs_t *jobs, job_worker_t *worker, const job_t *job) {
+  mtx_lock(&worker->lock);
+  bool full = worker->bottom - worker->top == JOBS_QUEUE_SIZE;
+  if (!full) {
+    worker->queue[worker->bottom++ % JOBS_QUEUE_SIZE] = *job;
+    atomic_fetch_add(&jobs->queued, 1);
+  }
+  mtx_unlock(&worker->lock);
+  return !full;
+}
+/* Take a job from a worker's queue, the newest if it's ours else the oldest */
+static bool take(jobs_t *jobs, job_worker_t *worker, bool own, job_t *job) {
+  mtx_lock(&worker->lock);
+  bool empty = worker->bottom == worker->top;
+  if (!empty) {
+    *job = own
+      ? worker->queue[--worker->bottom % JOBS_QUEUE_SIZE]
+      : worker->queue[worker->top++ % JOBS_QUEUE_SIZE];
+    atomic_fetch_sub(&jobs->queued, 1);
+  }
+  mtx_unlock(&worker->lock);
+  return !empty;
+}
+/* Run a job and count it as done */
+static void run(const job_t *job, uint32_t worker) {
+  job->fn(job->data, job->begin, job->end, worker);
+  if (job->counter) {
+    atomic_fetch_sub_explicit(&job->counter->pending, 1, memory_order_release);
+  }
+}
+/* Run one job, our own if we have any else a stolen one */
+static bool run_one(jobs_t *jobs, uint32_t index) {
+  job_t job;
+  for (uint32_t i = 0; i < jobs->num_workers; i++) {
+    uint32_t victim = (index + i) % jobs->num_workers;
+    if (take(jobs, &jobs->workers[victim], i == 0, &job)) {
+      run(&job, index);
+      return true;
+    }
+  }
+  return false;
+}
+/* Wake sleeping workers after queueing jobs */
+static void wake(jobs_t *jobs) {
+  mtx_lock(&jobs->sleep_lock);
+  cnd_broadcast(&jobs->wake);
+  mtx_unlock(&jobs->sleep_lock);
+}
+/* Push without waking anyone, running the job now if the queue is full */
+static void queue(
+    jobs_t *jobs,
+    job_fn_t fn,
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    job_counter_t *counter
+) {
+  job_t job = { fn, data, begin, end, counter };
+  uint32_t index = self(jobs);
+  if (counter) {
+    atomic_fetch_add_explicit(&counter->pending, 1, memory_order_relaxed);
+  }
+  if (jobs->num_workers == 1 || !push(jobs, &jobs->workers[index], &job)) {
+    run(&job, index);
+  }
+}
+/* Worker thread */
+static int worker_main(void *arg) {
+  job_worker_t *worker = arg;
+  jobs_t *jobs = worker->jobs;
+  current.jobs = jobs;
+  current.index = (uint32_t)(worker - jobs->workers);
+  while (!atomic_load(&jobs->stopping)) {
+    if (run_one(jobs, current.index)) continue;
+    mtx_lock(&jobs->sleep_lock);
+    while (!atomic_load(&jobs->queued) && !atomic_load(&jobs->stopping)) {
+      cnd_wait(&jobs->wake, &jobs->sleep_lock);
+    }
+    mtx_unlock(&jobs->sleep_lock);
+  }
+  return 0;
+}
+/* Stop the workers, joining threads [1, started), and free everything */
+static void stop(jobs_t *jobs, uint32_t started) {
+  atomic_store(&jobs->stopping, true);
+  wake(jobs);
+  for (uint32_t i = 1; i < started; i++) {
+    thrd_join(jobs->threads[i], NULL);
+  }
+  for (uint32_t i = 0; i < jobs->num_workers; i++) {
+    mtx_destroy(&jobs->workers[i].lock);
+    arena_destroy(&jobs->workers[i].arena);
+  }
+  mtx_destroy(&jobs->sleep_lock);
+  cnd_destroy(&jobs->wake);
+  free(jobs->workers);
+  free(jobs->threads);
+  jobs->workers = NULL;
+  jobs->threads = NULL;
+  jobs->num_workers = 0;
+}
+
+/* Start a scheduler with a number of workers, 0 for one per cpu */
+bool jobs_create(jobs_t *jobs, uint32_t workers) {
+  if (!workers) {
+    const char *env = getenv(JOBS_ENV);
+    long cpus = env ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (uint32_t)cpus : 1;
+  }
+  jobs->num_workers = 0;
+  jobs->workers = malloc(workers * sizeof(job_worker_t));
+  jobs->threads = malloc(workers * sizeof(thrd_t));
+  if (!jobs->workers || !jobs->threads) {
+    free(jobs->workers);
+    free(jobs->threads);
+    jobs->workers = NULL;
+    jobs->threads = NULL;
+    return false;
+  }
+  atomic_init(&jobs->queued, 0);
+  atomic_init(&jobs->stopping, false);
+  mtx_init(&jobs->sleep_lock, mtx_plain);
+  cnd_init(&jobs->wake);
+  for (uint32_t i = 0; i < workers; i++) {
+    job_worker_t *worker = &jobs->workers[i];
+    worker->jobs = jobs;
+    mtx_init(&worker->lock, mtx_plain);
+    worker->top = worker->bottom = 0;
+    arena_create(&worker->arena, JOBS_ARENA_SIZE);
+  }
+  /*
+   * Worker 0 is us, start the rest against the final count so they never see
+   * it change. If one fails, stop those that started and run with that many
+   */
+  jobs->num_workers = workers;
+  for (uint32_t i = 1; i < workers; i++) {
+    thrd_t *thread = &jobs->threads[i];
+    if (thrd_create(thread, worker_main, &jobs->workers[i]) != thrd_success) {
+      stop(jobs, i);
+      return jobs_create(jobs, i);
+    }
+  }
+  return true;
+}
+/* Stop the scheduler, queued jobs must have finished */
+void jobs_destroy(jobs_t *jobs) {
+  if (!jobs->workers) return;
+  stop(jobs, jobs->num_workers);
+}
+/* Queue a job over [begin, end), counting it in counter (may be NULL) */
+void jobs_submit(
+    jobs_t *jobs,
+    job_fn_t fn,
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    job_counter_t *counter
+) {
+  queue(jobs, fn, data, begin, end, counter);
+  if (jobs->num_workers > 1) wake(jobs);
+}
+/* Wait for a counter to reach zero, running jobs in the meantime */
+void jobs_wait(jobs_t *jobs, job_counter_t *counter) {
+  uint32_t index = self(jobs);
+  while (atomic_load_explicit(&counter->pending, memory_order_acquire)) {
+    if (!run_one(jobs, index)) thrd_yield();
+  }
+}
+/*
+ * Split [0, count) into jobs of up to grain items (each starting at a multiple
+ * of grain) and wait for them all
+ */
+void jobs_parallel_for(
+    jobs_t *jobs,
+    job_fn_t fn,
+    void *data,
+    uint32_t count,
+    uint32_t grain
+) {
+  if (!grain) grain = 1;
+  /* Nothing to split, skip the queues */
+  if (jobs->num_workers == 1 || count <= grain) {
+    for (uint32_t i = 0; i < count; i += grain) {
+      fn(data, i, count - i < grain ? count : i + grain, self(jobs));
+    }
+    return;
+  }
+  job_counter_t counter = { 0 };
+  for (uint32_t i = 0; i < count; i += grain) {
+    queue(jobs, fn, data, i, count - i < grain ? count : i + grain, &counter);
+  }
+  wake(jobs);
+  jobs_wait(jobs, &counter);
+}
+/* Scratch arena of a worker, only use it from inside that worker's jobs */
+arena_t *jobs_arena(jobs_t *jobs, uint32_t worker) {
+  return &jobs->workers[worker].arena;
+}
+/* Reset every worker's arena, call once per frame while nothing is running */
+void jobs_reset(jobs_t *jobs) {
+  for (uint32_t i = 0; i < jobs->num_workers; i++) {
+    arena_reset(&jobs->workers[i].arena);
+  }
+}
@@ -0,0 +1,49 @@
+/* Implements kernels_select() from kernels.h */
+#include <kernels.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* All kernel sets, best last */
+static const kernels_t *all_kernels[] = {
+  &kernels_generic,
+  &kernels_avx2,
+  &kernels_avx512,
+};
+#define NUM_KERNELS (sizeof(all_kernels) / sizeof(all_kernels[0]))
+
+/* Whether this cpu can run a kernel set */
+static bool supported(const kernels_t *kernels) {
+  if (!kernels->built) return false;
+  if (kernels == &kernels_generic) return true;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  if (kernels == &kernels_avx2) {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  }
+  if (kernels == &kernels_avx512) {
+    return __builtin_cpu_supports("avx512f")
+      && __builtin_cpu_supports("avx512bw")
+      && __builtin_cpu_supports("avx512vl");
+  }
+#endif
+  return false;
+}
+
+/* Pick the best kernel set for this cpu (or the one forced by KERNELS_ENV) */
+const kernels_t *kernels_select(void) {
+  const char *forced = getenv(KERNELS_ENV);
+  if (forced && *forced) {
+    for (size_t i = 0; i < NUM_KERNELS; i++) {
+      if (!strcmp(all_kernels[i]->name, forced) && supported(all_kernels[i])) {
+        return all_kernels[i];
+      }
+    }
+    fprintf(stderr, "%s=%s: not available here, ignoring\n",
+        KERNELS_ENV, forced);
+  }
+  for (size_t i = NUM_KERNELS; i > 0; i--) {
+    if (supported(all_kernels[i-1])) return all_kernels[i-1];
+  }
+  return &kernels_generic;
+}
@@ -0,0 +1,8 @@
+/* AVX2 kernels, the Makefile builds this with -mavx2 -mfma on x86 */
+#define KERNELS_SUFFIX avx2
+#if defined(__AVX2__) && defined(__FMA__)
+#define KERNELS_BUILT true
+#else
+#define KERNELS_BUILT false
+#endif
+#include "kernels_impl.h"
@@ -0,0 +1,8 @@
+/* AVX-512 kernels, the Makefile builds this with -mavx512* on x86 */
+#define KERNELS_SUFFIX avx512
+#if defined(__AVX512F__) && defined(__AVX512BW__) && defined(__AVX512VL__)
+#define KERNELS_BUILT true
+#else
+#define KERNELS_BUILT false
+#endif
+#include "kernels_impl.h"
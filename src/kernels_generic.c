@@ -0,0 +1,4 @@
+/* Generic kernels, baseline instruction set */
+#define KERNELS_SUFFIX generic
+#define KERNELS_BUILT true
+#include "kernels_impl.h"
@@ -0,0 +1,197 @@
+/*
+ * Kernel bodies, included by each kernels_*.c file with KERNELS_SUFFIX
+ * defined. The Makefile builds each of those files with its own instruction
+ * set flags, so the compiler gets to vectorize the same code differently.
+ */
+#include <kernels.h>
+#include <string.h>
+#include <math.h>
+
+/* Name a kernel for this instruction set */
+#define KERNEL_CAT_(a, b) a##_##b
+#define KERNEL_CAT(a, b) KERNEL_CAT_(a, b)
+#define KERNEL(name) KERNEL_CAT(name, KERNELS_SUFFIX)
+#define KERNEL_STR_(a) #a
+#define KERNEL_STR(a) KERNEL_STR_(a)
+
+/* Fill depth elements of a type with the clear value */
+#define FILL_DEPTH(type) { \
+    type value; \
+    memcpy(&value, clear, sizeof(type)); \
+    type *restrict depth = (type *)renderer->depthbuffer + start; \
+    for (size_t i = 0; i < count; i++) depth[i] = value; \
+  }
+/*
+ * Clear a contiguous range of the colour and depth buffers, clear is an
+ * element of the depth format's clear value
+ */
+static void KERNEL(fill)(
+    renderer_t *renderer,
+    size_t start,
+    size_t count,
+    const uint8_t *clear
+) {
+  uint32_t *restrict framebuffer = renderer->framebuffer + start;
+  for (size_t i = 0; i < count; i++) framebuffer[i] = 0;
+  switch (renderer->depth_format) {
+    case DEPTH_UNORM16: FILL_DEPTH(uint16_t) break;
+    case DEPTH_UNORM24: FILL_DEPTH(depth24_t) break;
+    default: FILL_DEPTH(float) break;
+  }
+}
+#undef FILL_DEPTH
+/* Clear colour and depth buffers inside a rect */
+static void KERNEL(clear)(renderer_t *renderer, rect_t rect) {
+  if (rect.x1 <= rect.x0 || rect.y1 <= rect.y0) return;
+  uint8_t clear[DEPTH_MAX_SIZE];
+  depth_format_clear(renderer->depth_format, clear);
+  /*
+   * Full width rows of whole tiles (up to the padded bottom of the frame) are
+   * one range
+   */
+  if (
+      rect.x0 == 0 && rect.x1 >= renderer->width &&
+      !(rect.y0 & TILE_MASK) &&
+      (!(rect.y1 & TILE_MASK) || rect.y1 >= renderer->height)
+  ) {
+    uint32_t y1 = rect.y1 < renderer->height ? rect.y1 : renderer->height;
+    y1 = (y1 + TILE_MASK) & ~TILE_MASK;
+    KERNEL(fill)(
+        renderer,
+        PIXEL_INDEX(renderer, 0, rect.y0),
+        (size_t)(y1 - rect.y0) * renderer->tiles_x * TILE_SIZE,
+        clear
+    );
+    return;
+  }
+  /* Otherwise each tile row of the rect is contiguous */
+  for (uint32_t y = rect.y0; y < rect.y1; y++) {
+    for (uint32_t x = rect.x0; x < rect.x1;) {
+      uint32_t end = (x | TILE_MASK) + 1;
+      if (end > rect.x1) end = rect.x1;
+      KERNEL(fill)(renderer, PIXEL_INDEX(renderer, x, y), end - x, clear);
+      x = end;
+    }
+  }
+}
+/* Transform triangle points by a matrix (w = 1) */
+static void KERNEL(transform)(
+    tri_t *restrict tris,
+    size_t count,
+    const m4x4_t *restrict m
+) {
+  const m4x4_t mat = *m;
+  for (size_t i = 0; i < count; i++) {
+    for (size_t j = 0; j < 3; j++) {
+      vec3_t p = tris[i].points[j];
+      tris[i].points[j] = V3_FROM(
+          mat.m[0][0]*p.x + mat.m[0][1]*p.y + mat.m[0][2]*p.z + mat.m[0][3],
+          mat.m[1][0]*p.x + mat.m[1][1]*p.y + mat.m[1][2]*p.z + mat.m[1][3],
+          mat.m[2][0]*p.x + mat.m[2][1]*p.y + mat.m[2][2]*p.z + mat.m[2][3]
+      );
+    }
+  }
+}
+/* Get max of three floats */
+static float max(float a, float b, float c) {
+  return a > b ? (a > c ? a : c) : (b > c ? b : c);
+}
+/* Get min of three floats */
+static float min(float a, float b, float c) {
+  return a < b ? (a < c ? a : c) : (b < c ? b : c);
+}
+
+/* Create rgb from floats */
+static uint32_t rgb(float r, float g, float b) {
+  return (uint32_t)(r * 255) << 24 | (uint32_t)(g * 255) << 16 |
+    (uint32_t)(b * 255) << 8;
+}
+
+/* Clamp a depth value to a unorm range */
+#define UNORM(z, max) ((z) > 0 ? ((z) < (max) ? (uint32_t)(z) : (max)) : 0)
+
+/* Raster loops, one set of pipeline state variants per depth format */
+#if PIPELINE_RASTER_STATES != 8
+#error "raster_variants.h must define every raster pipeline state"
+#endif
+#define RASTER_FORMAT f32
+#define RASTER_DEPTH_T float
+#define RASTER_DEPTH_VALUE_T float
+#define RASTER_DEPTH_LOAD(p) (*(p))
+#define RASTER_DEPTH_STORE(p, z) (*(p) = (z))
+#define RASTER_DEPTH_ENCODE(z) (z)
+#define RASTER_DEPTH_PASS(z, old) ((z) < (old))
+#define RASTER_DEPTH_CLIP(z) ((z) <= 1)
+#include "raster_variants.h"
+#define RASTER_FORMAT f32_reversed
+#define RASTER_DEPTH_T float
+#define RASTER_DEPTH_VALUE_T float
+#define RASTER_DEPTH_LOAD(p) (*(p))
+#define RASTER_DEPTH_STORE(p, z) (*(p) = (z))
+#define RASTER_DEPTH_ENCODE(z) (z)
+#define RASTER_DEPTH_PASS(z, old) ((z) > (old))
+#define RASTER_DEPTH_CLIP(z) ((z) >= 0)
+#include "raster_variants.h"
+#define RASTER_FORMAT unorm16
+#define RASTER_DEPTH_T uint16_t
+#define RASTER_DEPTH_VALUE_T uint16_t
+#define RASTER_DEPTH_LOAD(p) (*(p))
+#define RASTER_DEPTH_STORE(p, z) (*(p) = (z))
+#define RASTER_DEPTH_ENCODE(z) (uint16_t)UNORM(z, DEPTH_UNORM16_MAX)
+#define RASTER_DEPTH_PASS(z, old) ((z) < (old))
+#define RASTER_DEPTH_CLIP(z) ((z) < DEPTH_UNORM16_MAX)
+#include "raster_variants.h"
+#define RASTER_FORMAT unorm24
+#define RASTER_DEPTH_T depth24_t
+#define RASTER_DEPTH_VALUE_T uint32_t
+#define RASTER_DEPTH_LOAD(p) DEPTH24_LOAD(p)
+#define RASTER_DEPTH_STORE(p, z) DEPTH24_STORE(p, z)
+#define RASTER_DEPTH_ENCODE(z) UNORM(z, DEPTH_UNORM24_MAX)
+#define RASTER_DEPTH_PASS(z, old) ((z) < (old))
+#define RASTER_DEPTH_CLIP(z) ((z) < DEPTH_UNORM24_MAX)
+#include "raster_variants.h"
+
+/* Table row of every pipeline state variant of a depth format */
+#define RASTER_VARIANTS(format) { \
+  KERNEL(rasterize_##format##_0), KERNEL(rasterize_##format##_1), \
+  KERNEL(rasterize_##format##_2), KERNEL(rasterize_##format##_3), \
+  KERNEL(rasterize_##format##_4), KERNEL(rasterize_##format##_5), \
+  KERNEL(rasterize_##format##_6), KERNEL(rasterize_##format##_7), \
+}
+
+/* Copy the framebuffer into dst in linear order, pitch is in bytes */
+static void KERNEL(resolve)(
+    const renderer_t *renderer,
+    uint32_t *dst,
+    size_t pitch
+) {
+  uint32_t full = renderer->width >> TILE_SHIFT;
+  uint32_t rest = renderer->width & TILE_MASK;
+  for (uint32_t y = 0; y < renderer->height; y++) {
+    uint32_t *restrict out = (uint32_t *)((uint8_t *)dst + y * pitch);
+    const uint32_t *restrict in =
+      renderer->framebuffer + PIXEL_INDEX(renderer, 0, y);
+    /* One tile row at a time, fixed size so it stays in registers */
+    for (uint32_t t = 0; t < full; t++) {
+      memcpy(out, in, TILE_SIZE * sizeof(uint32_t));
+      out += TILE_SIZE;
+      in += TILE_PIXELS;
+    }
+    memcpy(out, in, rest * sizeof(uint32_t));
+  }
+}
+
+/* Kernel table */
+const kernels_t KERNEL(kernels) = {
+  .name = KERNEL_STR(KERNELS_SUFFIX),
+  .built = KERNELS_BUILT,
+  .clear = KERNEL(clear),
+  .transform = KERNEL(transform),
+  .rasterize = {
+    [DEPTH_F32] = RASTER_VARIANTS(f32),
+    [DEPTH_F32_REVERSED] = RASTER_VARIANTS(f32_reversed),
+    [DEPTH_UNORM16] = RASTER_VARIANTS(unorm16),
+    [DEPTH_UNORM24] = RASTER_VARIANTS(unorm24),
+  },
+  .resolve = KERNEL(resolve),
+};
@@ -1,8 +1,13 @@
 /* Includes */
 #include <renderer.h>
+#include <kernels.h>
+#include <capture.h>
+#include <batch.h>
+#include <distrib.h>
 #include <SDL2/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Consts */
 #define SENSITIVITY       32
@@ -16,39 +21,16 @@
 #define FLOOR_TILES       100
 #define NOISE_SIZE        FLOOR_TILES/4
 #define PERMUTATION_SIZE  256
+#define FLOOR_JOB_ROWS    8
+/* Set to a path to record frames, e.g. frame%05u.png or out.y4m */
+#define CAPTURE_ENV       "RENDERER_CAPTURE"
+#define CAPTURE_SLOTS     4
+/* Default batch mode resolution */
+#define BATCH_WIDTH       800
+#define BATCH_HEIGHT      600
 
 /* Noise data */
-int permutation[PERMUTATION_SIZE];
-/* Mesh data */
-tri_t mesh_data[FLOOR_TILES*FLOOR_TILES*2];
-/*
-tri_t mesh_data[] = {
-  {
-    .points = {
-      {.v = { -0.5,  0.0, -0.5 }},
-      {.v = {  0.5,  0.0, -0.5 }},
-      {.v = {  0.5,  0.0,  0.5 }},
-    },
-    .cols = {
-      {.v = {  1.0,  0.0,  0.0 }},
-      {.v = {  0.0,  1.0,  0.0 }},
-      {.v = {  0.0,  0.0,  1.0 }},
-    }
-  }, {
-    .points = {
-      {.v = {  0.5,  0.0,  0.5 }},
-      {.v = { -0.5,  0.0,  0.5 }},
-      {.v = { -0.5,  0.0, -0.5 }},
-    },
-    .cols = {
-      {.v = {  0.0,  0.0,  1.0 }},
-      {.v = {  1.0,  1.0,  0.0 }},
-      {.v = {  1.0,  0.0,  0.0 }},
-    }
-  }
-};
-*/
-
+int permutation[PERMUTATION_SIZE*2];
 /* Helpers for get noise */
 float lerp(float a, float b, float t) { return a + (b - a) * t; }
 float fade(float t) { return t * t * t * (t * (t * 6 - 15) + 10); }
@@ -102,32 +84,100 @@ float noise(float x, float y) {
   );
 }
 
-/* Entry point */
-int main(void) {
-  SDL_Init(SDL_INIT_EVERYTHING);
-  SDL_Window *sdl_window = SDL_CreateWindow(
-      "Rasterizer",
-      SDL_WINDOWPOS_CENTERED,
-      SDL_WINDOWPOS_CENTERED,
-      800, 600,
-      SDL_WINDOW_RESIZABLE
-  );
-  SDL_SetRelativeMouseMode(SDL_TRUE);
-  SDL_Renderer *sdl_renderer = SDL_CreateRenderer(sdl_window, -1, 0);
-  SDL_Texture *sdl_texture = SDL_CreateTexture(
-      sdl_renderer,
-      SDL_PIXELFORMAT_RGBA8888,
-      SDL_TEXTUREACCESS_STREAMING,
-      800/SCALE_DOWN, 600/SCALE_DOWN
+/* Fill rows [begin, end) of the floor's heights with noise */
+static void noise_job(
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    uint32_t worker
+) {
+  heightfield_t *terrain = data;
+  (void)worker;
+  for (int j = begin; j < (int)end; j++) {
+    for (int i = 0; i < FLOOR_TILES+1; i++) {
+      float n = noise((float)i/(float)FLOOR_TILES, (float)j/(float)FLOOR_TILES);
+      terrain->heights[j*(FLOOR_TILES+1)+i] = n * 2;
+    }
+  }
+}
+
+/* Print usage */
+static int usage(const char *name) {
+  fprintf(
+      stderr,
+      "usage: %s [--batch <poses> <output%%05u.png> [-s WxH] [-j threads]\n"
+      "        [-p processes]]\n",
+      name
   );
-  renderer_t renderer;
+  return 1;
+}
+/* Render a list of camera poses, headless */
+static int batch_main(int argc, char **argv, const mesh_t *mesh) {
+  if (argc < 4 || strcmp(argv[1], "--batch")) return usage(argv[0]);
+  batch_config_t config = {
+    .output = argv[3],
+    .width = BATCH_WIDTH,
+    .height = BATCH_HEIGHT,
+    .threads = 0,
+  };
+  uint32_t processes = 0;
+  for (int i = 4; i < argc; i++) {
+    if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%ux%u", &config.width, &config.height) != 2) {
+        return usage(argv[0]);
+      }
+    } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      config.threads = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+      processes = atoi(argv[++i]);
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  uint32_t num_poses;
+  batch_pose_t *poses = batch_load_poses(argv[2], &num_poses);
+  if (!poses) {
+    fprintf(stderr, "couldn't load poses from %s\n", argv[2]);
+    return 1;
+  }
+  uint64_t start = SDL_GetPerformanceCounter();
+  uint32_t written;
+  if (processes) {
+    /* Split the scene over processes instead of the views over threads */
+    distrib_config_t distrib_config = {
+      .output = config.output,
+      .width = config.width,
+      .height = config.height,
+      .processes = processes,
+    };
+    written = distrib_render(&distrib_config, poses, num_poses, mesh);
+  } else {
+    written = batch_render(&config, poses, num_poses, mesh);
+  }
+  float seconds = (float)(SDL_GetPerformanceCounter() - start)
+    / (float)SDL_GetPerformanceFrequency();
+  printf("rendered %u/%u views in %fs\n", written, num_poses, seconds);
+  free(poses);
+  return written == num_poses ? 0 : 1;
+}
+
+/* Entry point */
+int main(int argc, char **argv) {
   mesh_t mesh;
-  renderer_create(&renderer, 800/SCALE_DOWN, 600/SCALE_DOWN);
-  mesh.tris = mesh_data;
-  mesh.num_tris = sizeof(mesh_data) / sizeof(tri_t);
-  mesh.translate = V3_FROM(0, 0, 0);
+  heightfield_t terrain;
+  if (!heightfield_create(&terrain, FLOOR_TILES, FLOOR_TILES, false)) {
+    fprintf(stderr, "couldn't allocate the floor\n");
+    return 1;
+  }
+  mesh.tris = NULL;
+  mesh.num_tris = 0;
+  mesh.heightfield = &terrain;
+  mesh.translate = V3_FROM(-FLOOR_TILES/2, 0, -FLOOR_TILES/2);
   mesh.scale = V3_FROM(1, 1, 1);
   mesh.rotate = V3_FROM(0, 0, 0);
+  mesh.version = 0;
+  mesh.normals = NULL;
+  mesh.normals_version = 0;
 
   /* Generate permutation */
   for (int i = 0; i < PERMUTATION_SIZE; i++) {
@@ -143,57 +193,85 @@ int main(void) {
     permutation[PERMUTATION_SIZE+i] = permutation[i];
   }
 
+  /* Renderer, its workers generate the floor too */
+  renderer_t renderer;
+  if (!renderer_create(&renderer, 800/SCALE_DOWN, 600/SCALE_DOWN, 0)) {
+    fprintf(stderr, "couldn't start the renderer's workers\n");
+    heightfield_destroy(&terrain);
+    return 1;
+  }
+
   /* Generate floor */
-  float offsets[(FLOOR_TILES+1)*(FLOOR_TILES+1)];
   /* Old (basic noise) */
-  /*for (int i = 0; i < FLOOR_TILES+1; i++) {
-    for (int j = 0; j < FLOOR_TILES+1; j++) {
-      offsets[i*(FLOOR_TILES+1)+j] = (float)rand() / (float)RAND_MAX;
-    }
+  /*for (int i = 0; i < (FLOOR_TILES+1)*(FLOOR_TILES+1); i++) {
+    terrain.heights[i] = (float)rand() / (float)RAND_MAX;
   }*/
   /* New (perlin noise) */
-  for (int i = 0; i < FLOOR_TILES+1; i++) {
-    for (int j = 0; j < FLOOR_TILES+1; j++) {
-      float n = noise((float)i/(float)FLOOR_TILES, (float)j/(float)FLOOR_TILES);
-      offsets[i*(FLOOR_TILES+1)+j] = n * 2;
-    }
+  jobs_parallel_for(
+      &renderer.jobs,
+      noise_job,
+      &terrain,
+      FLOOR_TILES+1,
+      FLOOR_JOB_ROWS
+  );
+
+  /* Batch mode, which has a renderer per thread instead */
+  if (argc > 1) {
+    renderer_destroy(&renderer);
+    int status = batch_main(argc, argv, &mesh);
+    heightfield_destroy(&terrain);
+    return status;
   }
 
-  /* Generate actual mesh */
-  for (int i = 0; i < FLOOR_TILES; i++) {
-    for (int j = 0; j < FLOOR_TILES; j++) {
-      /* Append the relevant quad, 1 triangle at a time */
-      float x = (float)(-FLOOR_TILES)/2 + (float)i;
-      float z = (float)(-FLOOR_TILES)/2 + (float)j;
-      float z_offsets[4];
-      z_offsets[0] = offsets[(i*(FLOOR_TILES+1)+j)];
-      z_offsets[1] = offsets[(i*(FLOOR_TILES+1)+j+1)];
-      z_offsets[2] = offsets[((i+1)*(FLOOR_TILES+1)+j+1)];
-      z_offsets[3] = offsets[((i+1)*(FLOOR_TILES+1)+j)];
-      mesh_data[(i*FLOOR_TILES+j)*2].points[0] = V3_FROM(x, z_offsets[0], z);
-      mesh_data[(i*FLOOR_TILES+j)*2].points[1] = V3_FROM(x, z_offsets[1], z+1);
-      mesh_data[(i*FLOOR_TILES+j)*2].points[2] = V3_FROM(x+1, z_offsets[2], z+1);
-      mesh_data[(i*FLOOR_TILES+j)*2].cols[0] = v3scale(V3_FROM(1, 1, 1), z_offsets[0]);
-      mesh_data[(i*FLOOR_TILES+j)*2].cols[1] = v3scale(V3_FROM(1, 1, 1), z_offsets[1]);
-      mesh_data[(i*FLOOR_TILES+j)*2].cols[2] = v3scale(V3_FROM(1, 1, 1), z_offsets[2]);
-      //mesh_data[(i*FLOOR_TILES+j)*2].cols[0] = V3_FROM(1, 1, 1);
-      //mesh_data[(i*FLOOR_TILES+j)*2].cols[1] = V3_FROM(1, 1, 1);
-      //mesh_data[(i*FLOOR_TILES+j)*2].cols[2] = V3_FROM(1, 1, 1);
-      mesh_data[(i*FLOOR_TILES+j)*2+1].points[0] = V3_FROM(x+1, z_offsets[2], z+1);
-      mesh_data[(i*FLOOR_TILES+j)*2+1].points[1] = V3_FROM(x+1, z_offsets[3], z);
-      mesh_data[(i*FLOOR_TILES+j)*2+1].points[2] = V3_FROM(x, z_offsets[0], z);
-      mesh_data[(i*FLOOR_TILES+j)*2+1].cols[0] = v3scale(V3_FROM(1, 1, 1), z_offsets[2]);
-      mesh_data[(i*FLOOR_TILES+j)*2+1].cols[1] = v3scale(V3_FROM(1, 1, 1), z_offsets[3]);
-      mesh_data[(i*FLOOR_TILES+j)*2+1].cols[2] = v3scale(V3_FROM(1, 1, 1), z_offsets[0]);
-      //mesh_data[(i*FLOOR_TILES+j)*2+1].cols[0] = V3_FROM(1, 1, 1);
-      //mesh_data[(i*FLOOR_TILES+j)*2+1].cols[1] = V3_FROM(1, 1, 1);
-      //mesh_data[(i*FLOOR_TILES+j)*2+1].cols[2] = V3_FROM(1, 1, 1);
-    }
+  /* Window */
+  SDL_Init(SDL_INIT_EVERYTHING);
+  SDL_Window *sdl_window = SDL_CreateWindow(
+      "Rasterizer",
+      SDL_WINDOWPOS_CENTERED,
+      SDL_WINDOWPOS_CENTERED,
+      800, 600,
+      SDL_WINDOW_RESIZABLE
+  );
+  SDL_SetRelativeMouseMode(SDL_TRUE);
+  SDL_Renderer *sdl_renderer = SDL_CreateRenderer(sdl_window, -1, 0);
+  SDL_Texture *sdl_texture = SDL_CreateTexture(
+      sdl_renderer,
+      SDL_PIXELFORMAT_RGBA8888,
+      SDL_TEXTUREACCESS_STREAMING,
+      800/SCALE_DOWN, 600/SCALE_DOWN
+  );
+  printf(
+      "kernels: %s, workers: %u\n",
+      renderer.kernels->name,
+      renderer.jobs.num_workers
+  );
+
+  /* Start capture if asked */
+  capture_t capture;
+  bool capturing = false;
+  const char *capture_path = getenv(CAPTURE_ENV);
+  if (capture_path) {
+    capture_config_t config = {
+      .format = capture_guess_format(capture_path),
+      .path = capture_path,
+      .slots = CAPTURE_SLOTS,
+      .block = false,
+      .fps = FRAMERATE_CAP,
+    };
+    capturing = capture_create(
+        &capture,
+        &config,
+        renderer.width,
+        renderer.height
+    );
+    if (!capturing) fprintf(stderr, "couldn't capture to %s\n", capture_path);
   }
 
   /* Main loop */
   const uint8_t *keys = SDL_GetKeyboardState(NULL);
   bool running = true;
+  bool repaint = true;
+  const mesh_t *meshes[] = { &mesh };
   uint64_t now = SDL_GetPerformanceCounter();
   uint64_t last = 0;
   float delta_time = 0;
@@ -208,7 +286,18 @@ int main(void) {
     delta_time = (float)(now - last) / (float)SDL_GetPerformanceFrequency();
     ticks++;
     if (ticks % 200 == 0) {
-      printf("fps: %f\n", 1/delta_time);
+      /* Scratch memory is in the workers' arenas, add them up */
+      size_t scratch = 0, peak = 0;
+      for (uint32_t i = 0; i < renderer.jobs.num_workers; i++) {
+        scratch += jobs_arena(&renderer.jobs, i)->last_frame;
+        peak += jobs_arena(&renderer.jobs, i)->peak;
+      }
+      printf(
+          "fps: %f, scratch: %zu bytes (peak %zu)\n",
+          1/delta_time,
+          scratch,
+          peak
+      );
     }
 
     /* Event loop */
@@ -218,6 +307,7 @@ int main(void) {
         running = false;
       }
       if (event.type == SDL_WINDOWEVENT) {
+        repaint = true;
         if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
           renderer_resize(
               &renderer,
@@ -225,7 +315,7 @@ int main(void) {
               event.window.data2/SCALE_DOWN
           );
           SDL_DestroyTexture(sdl_texture);
-          SDL_CreateTexture(
+          sdl_texture = SDL_CreateTexture(
               sdl_renderer,
               SDL_PIXELFORMAT_RGBA8888,
               SDL_TEXTUREACCESS_STREAMING,
@@ -282,20 +372,37 @@ int main(void) {
     renderer.camera.pitch += mousey*SENSITIVITY*delta_time;
     if (renderer.camera.pitch > 89) renderer.camera.pitch = 89;
     if (renderer.camera.pitch < -89) renderer.camera.pitch = -89;
-    renderer_clear(&renderer);
-    renderer_draw(&renderer, &mesh);
-    SDL_UpdateTexture(
-        sdl_texture,
-        NULL,
-        renderer.framebuffer,
-        renderer.width * sizeof(uint32_t)
-    );
-    SDL_RenderClear(sdl_renderer);
-    SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL);
-    SDL_RenderPresent(sdl_renderer);
+    /* Only upload and present if something changed */
+    bool changed = renderer_render(&renderer, meshes, 1);
+    /* Capture every frame, still ones too, so streams keep their frame rate */
+    if (capturing) capture_frame(&capture, &renderer);
+    if (changed) {
+      void *pixels;
+      int pitch;
+      if (SDL_LockTexture(sdl_texture, NULL, &pixels, &pitch) == 0) {
+        renderer_resolve(&renderer, pixels, pitch);
+        SDL_UnlockTexture(sdl_texture);
+      }
+      repaint = true;
+    }
+    if (repaint) {
+      SDL_RenderClear(sdl_renderer);
+      SDL_RenderCopy(sdl_renderer, sdl_texture, NULL, NULL);
+      SDL_RenderPresent(sdl_renderer);
+      repaint = false;
+    }
   }
 
+  if (capturing) {
+    capture_destroy(&capture);
+    printf(
+        "captured %llu frames, dropped %llu\n",
+        (unsigned long long)capture.written,
+        (unsigned long long)capture.dropped
+    );
+  }
   renderer_destroy(&renderer);
+  heightfield_destroy(&terrain);
   SDL_DestroyTexture(sdl_texture);
   SDL_DestroyRenderer(sdl_renderer);
   SDL_DestroyWindow(sdl_window);
@@ -0,0 +1,27 @@
+/* Implements the mesh normals part of renderer.h */
+#include <renderer.h>
+#include <stdlib.h>
+
+/* Unit face normal of a triangle */
+vec3_t tri_normal(const tri_t *tri) {
+  vec3_t a = v3sub(tri->points[2], tri->points[0]);
+  vec3_t b = v3sub(tri->points[1], tri->points[0]);
+  return v3normalize(v3cross(a, b));
+}
+/* Work out a mesh's model space unit face normals (allocates) */
+bool mesh_update_normals(mesh_t *mesh) {
+  if (mesh->heightfield) return true;
+  vec3_t *normals = realloc(mesh->normals, mesh->num_tris * sizeof(vec3_t));
+  if (!normals && mesh->num_tris) return false;
+  mesh->normals = normals;
+  for (uint32_t i = 0; i < mesh->num_tris; i++) {
+    normals[i] = tri_normal(&mesh->tris[i]);
+  }
+  mesh->normals_version = mesh->version;
+  return true;
+}
+/* Free a mesh's normals */
+void mesh_free_normals(mesh_t *mesh) {
+  free(mesh->normals);
+  mesh->normals = NULL;
+}
@@ -0,0 +1,253 @@
+/* Implements the mesh optimizer part of renderer.h */
+#include <renderer.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* Consts */
+/* Bits per axis of a triangle's Morton code */
+#define MORTON_BITS 10
+/* Simulated vertex cache size, and Forsyth's scoring constants */
+#define CACHE_SIZE 32
+#define CACHE_DECAY_POWER 1.5f
+#define LAST_TRI_SCORE 0.75f
+#define VALENCE_BOOST_SCALE 2.0f
+#define VALENCE_BOOST_POWER 0.5f
+/* Slots in the vertex welding table, a power of two over 2x the corners */
+#define WELD_SLOTS 8192
+/* No triangle picked */
+#define NONE UINT32_MAX
+
+/* Vertex, shared by the triangle corners with the same position and colour */
+typedef struct {
+  /* Position in the simulated cache, -1 if it's not in it */
+  int32_t cache_pos;
+  /* Triangles not yet emitted using it, and where its triangles are listed */
+  uint32_t remaining, first, count;
+  float score;
+} vertex_t;
+/* Scratch space for ordering a chunk */
+typedef struct {
+  /* Vertex of each triangle corner */
+  uint32_t ids[MESH_CHUNK_TRIS * 3];
+  /* Corner + 1 of the first use of each vertex, by hash */
+  uint32_t weld[WELD_SLOTS];
+  vertex_t verts[MESH_CHUNK_TRIS * 3];
+  /* Triangles of each vertex */
+  uint32_t adjacency[MESH_CHUNK_TRIS * 3];
+  float scores[MESH_CHUNK_TRIS];
+  bool emitted[MESH_CHUNK_TRIS];
+  uint32_t order[MESH_CHUNK_TRIS];
+} scratch_t;
+
+/* Spread the low 10 bits of x out to every third bit */
+static uint32_t spread_bits(uint32_t x) {
+  x &= 0x3FF;
+  x = (x | (x << 16)) & 0x030000FF;
+  x = (x | (x << 8)) & 0x0300F00F;
+  x = (x | (x << 4)) & 0x030C30C3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+/* Morton code of a point in [lo, hi] */
+static uint32_t morton(vec3_t p, vec3_t lo, vec3_t hi) {
+  uint32_t code = 0;
+  for (uint32_t k = 0; k < 3; k++) {
+    float extent = hi.v[k] - lo.v[k];
+    float f = extent > 0 ? (p.v[k] - lo.v[k]) / extent : 0;
+    uint32_t q = (uint32_t)(f * ((1 << MORTON_BITS) - 1) + 0.5f);
+    code |= spread_bits(q) << k;
+  }
+  return code;
+}
+/* Compare sort keys */
+static int compare_keys(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+/* Hash of a corner's position and colour */
+static uint32_t corner_hash(const tri_t *tri, uint32_t j) {
+  uint32_t words[6];
+  memcpy(words, &tri->points[j], sizeof(vec3_t));
+  memcpy(words + 3, &tri->cols[j], sizeof(vec3_t));
+  uint32_t h = 2166136261u;
+  for (uint32_t i = 0; i < 6; i++) h = (h ^ words[i]) * 16777619u;
+  return h;
+}
+/* Whether two corners are the same vertex */
+static bool corner_equal(
+    const tri_t *a,
+    uint32_t i,
+    const tri_t *b,
+    uint32_t j
+) {
+  return !memcmp(&a->points[i], &b->points[j], sizeof(vec3_t))
+    && !memcmp(&a->cols[i], &b->cols[j], sizeof(vec3_t));
+}
+/* Give every corner a vertex, returns the number of vertices */
+static uint32_t weld(scratch_t *s, const tri_t *tris, uint32_t n) {
+  memset(s->weld, 0, sizeof(s->weld));
+  uint32_t num_verts = 0;
+  for (uint32_t c = 0; c < n * 3; c++) {
+    uint32_t slot = corner_hash(&tris[c / 3], c % 3) & (WELD_SLOTS - 1);
+    for (;; slot = (slot + 1) & (WELD_SLOTS - 1)) {
+      uint32_t other = s->weld[slot];
+      if (!other) {
+        s->weld[slot] = c + 1;
+        s->ids[c] = num_verts++;
+        break;
+      }
+      if (corner_equal(&tris[c / 3], c % 3, &tris[(other - 1) / 3],
+            (other - 1) % 3)) {
+        s->ids[c] = s->ids[other - 1];
+        break;
+      }
+    }
+  }
+  return num_verts;
+}
+/* Forsyth's vertex score, favouring recently used and rarely used vertices */
+static float vertex_score(const vertex_t *v) {
+  if (!v->remaining) return -1;
+  float score = 0;
+  if (v->cache_pos >= 0) {
+    if (v->cache_pos < 3) {
+      /* Used by the last triangle, don't favour it too much over the rest */
+      score = LAST_TRI_SCORE;
+    } else {
+      float f = 1 - (float)(v->cache_pos - 3) / (CACHE_SIZE - 3);
+      score = powf(f, CACHE_DECAY_POWER);
+    }
+  }
+  float boost = powf((float)v->remaining, -VALENCE_BOOST_POWER);
+  return score + VALENCE_BOOST_SCALE * boost;
+}
+/* Score of a triangle, the sum of its vertices' */
+static float tri_score(const scratch_t *s, uint32_t t) {
+  return s->verts[s->ids[t * 3]].score
+    + s->verts[s->ids[t * 3 + 1]].score
+    + s->verts[s->ids[t * 3 + 2]].score;
+}
+/*
+ * Order a chunk's triangles for vertex cache reuse (Forsyth's linear speed
+ * algorithm), into s->order
+ */
+static void order_chunk(scratch_t *s, const tri_t *tris, uint32_t n) {
+  uint32_t num_verts = weld(s, tris, n);
+  /* List each vertex's triangles */
+  for (uint32_t v = 0; v < num_verts; v++) {
+    s->verts[v] = (vertex_t){ .cache_pos = -1 };
+  }
+  for (uint32_t c = 0; c < n * 3; c++) s->verts[s->ids[c]].count++;
+  for (uint32_t v = 0, first = 0; v < num_verts; v++) {
+    s->verts[v].first = first;
+    first += s->verts[v].count;
+  }
+  for (uint32_t c = 0; c < n * 3; c++) {
+    vertex_t *v = &s->verts[s->ids[c]];
+    s->adjacency[v->first + v->remaining++] = c / 3;
+  }
+  for (uint32_t v = 0; v < num_verts; v++) {
+    s->verts[v].score = vertex_score(&s->verts[v]);
+  }
+  for (uint32_t t = 0; t < n; t++) {
+    s->scores[t] = tri_score(s, t);
+    s->emitted[t] = false;
+  }
+
+  uint32_t cache[CACHE_SIZE];
+  uint32_t cached = 0;
+  uint32_t best = NONE;
+  for (uint32_t i = 0; i < n; i++) {
+    /* Nothing left near the cache, start again from the best anywhere */
+    if (best == NONE) {
+      for (uint32_t t = 0; t < n; t++) {
+        if (s->emitted[t]) continue;
+        if (best == NONE || s->scores[t] > s->scores[best]) best = t;
+      }
+    }
+    s->order[i] = best;
+    s->emitted[best] = true;
+    /* Put its vertices at the front of the cache, pushing the rest back */
+    uint32_t next[CACHE_SIZE + 3];
+    uint32_t m = 0;
+    for (uint32_t j = 0; j < 3; j++) {
+      uint32_t v = s->ids[best * 3 + j];
+      s->verts[v].remaining--;
+      next[m++] = v;
+    }
+    for (uint32_t j = 0; j < cached; j++) {
+      uint32_t v = cache[j];
+      if (v != next[0] && v != next[1] && v != next[2]) next[m++] = v;
+    }
+    for (uint32_t j = 0; j < m; j++) {
+      vertex_t *v = &s->verts[next[j]];
+      v->cache_pos = j < CACHE_SIZE ? (int32_t)j : -1;
+      v->score = vertex_score(v);
+    }
+    cached = m < CACHE_SIZE ? m : CACHE_SIZE;
+    memcpy(cache, next, cached * sizeof(uint32_t));
+    /* Rescore the triangles whose vertices changed, the best goes next */
+    best = NONE;
+    for (uint32_t j = 0; j < m; j++) {
+      const vertex_t *v = &s->verts[next[j]];
+      for (uint32_t a = 0; a < v->count; a++) {
+        uint32_t t = s->adjacency[v->first + a];
+        if (s->emitted[t]) continue;
+        s->scores[t] = tri_score(s, t);
+        if (best == NONE || s->scores[t] > s->scores[best]) best = t;
+      }
+    }
+  }
+}
+
+/* Reorder a mesh's triangles for locality (allocates temporarily) */
+bool mesh_optimize(mesh_t *mesh) {
+  uint32_t n = mesh->num_tris;
+  if (mesh->heightfield || !n) return true;
+  uint64_t *keys = malloc(n * sizeof(uint64_t));
+  tri_t *sorted = malloc(n * sizeof(tri_t));
+  scratch_t *scratch = malloc(sizeof(scratch_t));
+  if (!keys || !sorted || !scratch) {
+    free(keys);
+    free(sorted);
+    free(scratch);
+    return false;
+  }
+
+  /* Sort by the Morton code of the centroids, so each chunk is compact */
+  vec3_t lo = V3_FROM(INF, INF, INF);
+  vec3_t hi = V3_FROM(-INF, -INF, -INF);
+  for (uint32_t i = 0; i < n; i++) {
+    for (uint32_t j = 0; j < 3; j++) {
+      for (uint32_t k = 0; k < 3; k++) {
+        lo.v[k] = fminf(lo.v[k], mesh->tris[i].points[j].v[k]);
+        hi.v[k] = fmaxf(hi.v[k], mesh->tris[i].points[j].v[k]);
+      }
+    }
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    const vec3_t *p = mesh->tris[i].points;
+    vec3_t centroid = v3scale(v3add(v3add(p[0], p[1]), p[2]), 1.0f / 3);
+    keys[i] = (uint64_t)morton(centroid, lo, hi) << 32 | i;
+  }
+  qsort(keys, n, sizeof(uint64_t), compare_keys);
+  for (uint32_t i = 0; i < n; i++) {
+    sorted[i] = mesh->tris[(uint32_t)keys[i]];
+  }
+
+  /* Then order each chunk for reuse */
+  for (uint32_t first = 0; first < n; first += MESH_CHUNK_TRIS) {
+    uint32_t count = n - first < MESH_CHUNK_TRIS ? n - first : MESH_CHUNK_TRIS;
+    order_chunk(scratch, sorted + first, count);
+    for (uint32_t i = 0; i < count; i++) {
+      mesh->tris[first + i] = sorted[first + scratch->order[i]];
+    }
+  }
+  mesh->version++;
+  free(keys);
+  free(sorted);
+  free(scratch);
+  return true;
+}
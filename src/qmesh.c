@@ -0,0 +1,93 @@
+/* Implements the quantized mesh part of renderer.h */
+#include <renderer.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* Consts */
+#define QPOS_MAX ((float)QMESH_POS_MAX)
+#define QCOL_MAX 255.0f
+
+/* Quantize a float in 0-1 */
+static uint32_t quantize(float f, float max) {
+  if (!(f > 0)) return 0;
+  if (f >= 1) return (uint32_t)max;
+  return (uint32_t)(f * max + 0.5f);
+}
+
+/* Quantize mesh (allocates, colours are clamped to 0-1), false on failure */
+bool qmesh_create(qmesh_t *qmesh, const mesh_t *mesh) {
+  qmesh->num_tris = mesh->num_tris;
+  qmesh->tris = malloc(mesh->num_tris * sizeof(qtri_t));
+  qmesh->num_chunks =
+    (mesh->num_tris + QMESH_CHUNK_TRIS - 1) / QMESH_CHUNK_TRIS;
+  qmesh->chunks = malloc(qmesh->num_chunks * sizeof(qchunk_t));
+  if ((mesh->num_tris && !qmesh->tris)
+      || (qmesh->num_chunks && !qmesh->chunks)) {
+    qmesh_destroy(qmesh);
+    return false;
+  }
+  qmesh->translate = mesh->translate;
+  qmesh->scale = mesh->scale;
+  qmesh->rotate = mesh->rotate;
+
+  for (uint32_t c = 0; c < qmesh->num_chunks; c++) {
+    qchunk_t *chunk = &qmesh->chunks[c];
+    chunk->first_tri = c * QMESH_CHUNK_TRIS;
+    chunk->num_tris = mesh->num_tris - chunk->first_tri;
+    if (chunk->num_tris > QMESH_CHUNK_TRIS) chunk->num_tris = QMESH_CHUNK_TRIS;
+    /* Get chunk bounds */
+    vec3_t lo = V3_FROM(INF, INF, INF);
+    vec3_t hi = V3_FROM(-INF, -INF, -INF);
+    for (uint32_t i = 0; i < chunk->num_tris; i++) {
+      const tri_t *tri = &mesh->tris[chunk->first_tri + i];
+      for (uint32_t j = 0; j < 3; j++) {
+        for (uint32_t k = 0; k < 3; k++) {
+          lo.v[k] = fminf(lo.v[k], tri->points[j].v[k]);
+          hi.v[k] = fmaxf(hi.v[k], tri->points[j].v[k]);
+        }
+      }
+    }
+    chunk->origin = lo;
+    chunk->scale = v3scale(v3sub(hi, lo), 1 / QPOS_MAX);
+    /* Quantize */
+    for (uint32_t i = 0; i < chunk->num_tris; i++) {
+      const tri_t *tri = &mesh->tris[chunk->first_tri + i];
+      qtri_t *qtri = &qmesh->tris[chunk->first_tri + i];
+      for (uint32_t j = 0; j < 3; j++) {
+        for (uint32_t k = 0; k < 3; k++) {
+          float extent = hi.v[k] - lo.v[k];
+          float f = extent > 0 ? (tri->points[j].v[k] - lo.v[k]) / extent : 0;
+          qtri->verts[j].pos[k] = quantize(f, QPOS_MAX);
+          qtri->verts[j].col[k] = quantize(tri->cols[j].v[k], QCOL_MAX);
+        }
+        qtri->verts[j].col[3] = (uint8_t)QCOL_MAX;
+      }
+    }
+  }
+  return true;
+}
+/* Destroy quantized mesh */
+void qmesh_destroy(qmesh_t *qmesh) {
+  free(qmesh->tris);
+  free(qmesh->chunks);
+  qmesh->tris = NULL;
+  qmesh->chunks = NULL;
+  qmesh->num_tris = 0;
+  qmesh->num_chunks = 0;
+}
+/* Decode a quantized triangle back to a normal one */
+void qtri_decode(const qchunk_t *chunk, const qtri_t *qtri, tri_t *tri) {
+  for (uint32_t j = 0; j < 3; j++) {
+    const qvert_t *v = &qtri->verts[j];
+    tri->points[j] = V3_FROM(
+        chunk->origin.x + v->pos[0] * chunk->scale.x,
+        chunk->origin.y + v->pos[1] * chunk->scale.y,
+        chunk->origin.z + v->pos[2] * chunk->scale.z
+    );
+    tri->cols[j] = V3_FROM(
+        v->col[0] / QCOL_MAX,
+        v->col[1] / QCOL_MAX,
+        v->col[2] / QCOL_MAX
+    );
+  }
+}
@@ -0,0 +1,210 @@
+/*
+ * Raster loop, included by raster_variants.h once per depth format and
+ * pipeline state with:
+ * - RASTER_NAME: function name
+ * - RASTER_STATE: raster pipeline flags (PIPELINE_RASTER_MASK bits)
+ * - RASTER_DEPTH_T: depth buffer element type
+ * - RASTER_DEPTH_VALUE_T: type of an encoded depth value
+ * - RASTER_DEPTH_LOAD(p), RASTER_DEPTH_STORE(p, z): read and write an element
+ * - RASTER_DEPTH_ENCODE(z): interpolated depth to a buffer value
+ * - RASTER_DEPTH_PASS(z, old): depth test
+ * - RASTER_DEPTH_CLIP(z): whether interpolated depth is inside the far plane
+ */
+
+/* Colour of a flat shaded triangle, from its first vertex */
+#if RASTER_STATE & PIPELINE_SMOOTH
+#define RASTER_FLAT(tri) 0
+#else
+#define RASTER_FLAT(tri) \
+  rgb((tri)->cols[0].x, (tri)->cols[0].y, (tri)->cols[0].z)
+#endif
+
+/* Shade a covered sample with barycentrics u, v, w */
+static inline void KERNEL_CAT(RASTER_NAME, shade)(
+    const tri_t *tri,
+    float u,
+    float v,
+    float w,
+    uint32_t flat,
+    RASTER_DEPTH_T *depth,
+    uint32_t *colour
+) {
+  /* Not every variant uses every argument */
+  (void)tri;
+  (void)u;
+  (void)v;
+  (void)w;
+  (void)flat;
+  (void)depth;
+#if RASTER_STATE & (PIPELINE_DEPTH_TEST | PIPELINE_DEPTH_WRITE)
+  float z = u*tri->points[0].z + v*tri->points[1].z + w*tri->points[2].z;
+  /* Clip at the far plane, the same for every format */
+  if (!RASTER_DEPTH_CLIP(z)) return;
+  RASTER_DEPTH_VALUE_T encoded = RASTER_DEPTH_ENCODE(z);
+#endif
+#if RASTER_STATE & PIPELINE_DEPTH_TEST
+  if (!RASTER_DEPTH_PASS(encoded, RASTER_DEPTH_LOAD(depth))) return;
+#endif
+#if RASTER_STATE & PIPELINE_DEPTH_WRITE
+  RASTER_DEPTH_STORE(depth, encoded);
+#endif
+#if RASTER_STATE & PIPELINE_SMOOTH
+  *colour = rgb(
+      u*tri->cols[0].x + v*tri->cols[1].x + w*tri->cols[2].x,
+      u*tri->cols[0].y + v*tri->cols[1].y + w*tri->cols[2].y,
+      u*tri->cols[0].z + v*tri->cols[1].z + w*tri->cols[2].z
+  );
+#else
+  *colour = flat;
+#endif
+}
+
+/*
+ * Rasterize a triangle covering at most 2x2 samples, from the first sample
+ * (x, y) to the last (x1, y1) inclusive. Skips the block setup and only
+ * divides once per triangle.
+ */
+static void KERNEL_CAT(RASTER_NAME, small)(
+    renderer_t *renderer,
+    const tri_t *tri,
+    uint32_t x0,
+    uint32_t y0,
+    uint32_t x1,
+    uint32_t y1
+) {
+  const vec3_t p0 = tri->points[0];
+  vec2_t v0 = V2_FROM(tri->points[1].x - p0.x, tri->points[1].y - p0.y);
+  vec2_t v1 = V2_FROM(tri->points[2].x - p0.x, tri->points[2].y - p0.y);
+  /* Twice the signed area, the edge functions are scaled by the same */
+  float area = v0.x * v1.y - v0.y * v1.x;
+  if (area == 0) return;
+  float inv = 1 / area;
+  uint32_t flat = RASTER_FLAT(tri);
+  for (uint32_t y = y0; y <= y1; y++) {
+    for (uint32_t x = x0; x <= x1; x++) {
+      vec2_t r = V2_FROM(x - p0.x, y - p0.y);
+      float v = (r.x * v1.y - r.y * v1.x) * inv;
+      float w = (v0.x * r.y - v0.y * r.x) * inv;
+      float u = 1 - v - w;
+      if (!(u >= 0 && v >= 0 && w >= 0)) continue;
+      size_t i = PIXEL_INDEX(renderer, x, y);
+      KERNEL_CAT(RASTER_NAME, shade)(
+          tri, u, v, w, flat,
+          (RASTER_DEPTH_T *)renderer->depthbuffer + i,
+          &renderer->framebuffer[i]
+      );
+    }
+  }
+}
+
+/* Rasterize a triangle in screen space, inside a clip rect */
+static void RASTER_NAME(
+    renderer_t *renderer,
+    const tri_t *tri,
+    const rect_t *clip
+) {
+  /* Get bounds */
+  float xmin = min(tri->points[0].x, tri->points[1].x, tri->points[2].x);
+  float ymin = min(tri->points[0].y, tri->points[1].y, tri->points[2].y);
+  float xmax = max(tri->points[0].x, tri->points[1].x, tri->points[2].x);
+  float ymax = max(tri->points[0].y, tri->points[1].y, tri->points[2].y);
+  /* Clamp to the clip rect */
+  xmin = xmin > clip->x0 ? xmin : clip->x0;
+  ymin = ymin > clip->y0 ? ymin : clip->y0;
+  xmax = xmax < clip->x1 - 1.0f ? xmax : clip->x1 - 1.0f;
+  ymax = ymax < clip->y1 - 1.0f ? ymax : clip->y1 - 1.0f;
+  /*
+   * Snap inwards to the samples (integer coordinates) inside the bounds, a
+   * triangle that falls between samples covers nothing
+   */
+  xmin = ceilf(xmin);
+  ymin = ceilf(ymin);
+  xmax = floorf(xmax);
+  ymax = floorf(ymax);
+  if (!(xmin <= xmax && ymin <= ymax)) return;
+  uint32_t x_min = (uint32_t)xmin;
+  uint32_t y_min = (uint32_t)ymin;
+  uint32_t x_max = (uint32_t)xmax + 1;
+  uint32_t y_max = (uint32_t)ymax + 1;
+  if (x_max - x_min <= 2 && y_max - y_min <= 2) {
+    KERNEL_CAT(RASTER_NAME, small)(
+        renderer, tri, x_min, y_min, x_max - 1, y_max - 1
+    );
+    return;
+  }
+
+  /* Precompute where possible */
+  vec2_t v0 = V2_FROM(
+      tri->points[1].x - tri->points[0].x,
+      tri->points[1].y - tri->points[0].y
+  );
+  vec2_t v1 = V2_FROM(
+      tri->points[2].x - tri->points[0].x,
+      tri->points[2].y - tri->points[0].y
+  );
+  vec2_t d0 = V2_FROM(v2dot(v0, v0), v2dot(v0, v1));
+  vec2_t d1 = V2_FROM(v2dot(v1, v0), v2dot(v1, v1));
+  float d = d0.x * d1.y - d0.y * d0.y;
+  if (d == 0) return;
+
+  /*
+   * Barycentrics are affine in screen space, b = b_x*x + b_y*y + b_0, so they
+   * can be evaluated anywhere without the per pixel divides
+   */
+  const vec3_t p0 = tri->points[0];
+  float v_x = (d1.y * v0.x - d0.y * v1.x) / d;
+  float v_y = (d1.y * v0.y - d0.y * v1.y) / d;
+  float w_x = (d0.x * v1.x - d0.y * v0.x) / d;
+  float w_y = (d0.x * v1.y - d0.y * v0.y) / d;
+  float v_0 = -(v_x * p0.x + v_y * p0.y);
+  float w_0 = -(w_x * p0.x + w_y * p0.y);
+  uint32_t flat = RASTER_FLAT(tri);
+
+  /* Walk the bounds one 8x8 block (framebuffer tile) at a time */
+  for (uint32_t by = y_min & ~TILE_MASK; by < y_max; by += TILE_SIZE) {
+    uint32_t y0 = by > y_min ? by : y_min;
+    uint32_t y1 = by + TILE_SIZE < y_max ? by + TILE_SIZE : y_max;
+    for (uint32_t bx = x_min & ~TILE_MASK; bx < x_max; bx += TILE_SIZE) {
+      uint32_t x0 = bx > x_min ? bx : x_min;
+      uint32_t x1 = bx + TILE_SIZE < x_max ? bx + TILE_SIZE : x_max;
+      /*
+       * Classify the block by its corner samples: outside if they are all
+       * behind one edge, inside if none are behind any edge
+       */
+      uint32_t u_out = 0, v_out = 0, w_out = 0;
+      for (uint32_t c = 0; c < 4; c++) {
+        float cx = (float)(c & 1 ? x1 - 1 : x0);
+        float cy = (float)(c & 2 ? y1 - 1 : y0);
+        float v = v_x * cx + v_y * cy + v_0;
+        float w = w_x * cx + w_y * cy + w_0;
+        u_out += 1 - v - w < 0;
+        v_out += v < 0;
+        w_out += w < 0;
+      }
+      if (u_out == 4 || v_out == 4 || w_out == 4) continue;
+      bool inside = !(u_out | v_out | w_out);
+
+      /* Fill, only testing coverage in partially covered blocks */
+      RASTER_DEPTH_T *depthbuffer = (RASTER_DEPTH_T *)renderer->depthbuffer
+        + PIXEL_INDEX(renderer, bx, by);
+      uint32_t *framebuffer =
+        renderer->framebuffer + PIXEL_INDEX(renderer, bx, by);
+      for (uint32_t y = y0; y < y1; y++) {
+        for (uint32_t x = x0; x < x1; x++) {
+          float v = v_x * x + v_y * y + v_0;
+          float w = w_x * x + w_y * y + w_0;
+          float u = 1 - v - w;
+          if (!inside && !(u >= 0 && v >= 0 && w >= 0)) continue;
+          size_t i = ((y & TILE_MASK) << TILE_SHIFT) + (x & TILE_MASK);
+          KERNEL_CAT(RASTER_NAME, shade)(
+              tri, u, v, w, flat, &depthbuffer[i], &framebuffer[i]
+          );
+        }
+      }
+    }
+  }
+}
+
+#undef RASTER_FLAT
+#undef RASTER_NAME
+#undef RASTER_STATE
@@ -0,0 +1,43 @@
+/*
+ * Raster loop variants for one depth format, included by kernels_impl.h with
+ * RASTER_FORMAT (name suffix) and the RASTER_DEPTH_* macros of raster_impl.h
+ * defined. Defines KERNEL(rasterize_<format>_<state>) for every raster
+ * pipeline state.
+ */
+#define RASTER_VARIANT(state) \
+  KERNEL(KERNEL_CAT(KERNEL_CAT(rasterize, RASTER_FORMAT), state))
+
+#define RASTER_STATE 0
+#define RASTER_NAME RASTER_VARIANT(0)
+#include "raster_impl.h"
+#define RASTER_STATE 1
+#define RASTER_NAME RASTER_VARIANT(1)
+#include "raster_impl.h"
+#define RASTER_STATE 2
+#define RASTER_NAME RASTER_VARIANT(2)
+#include "raster_impl.h"
+#define RASTER_STATE 3
+#define RASTER_NAME RASTER_VARIANT(3)
+#include "raster_impl.h"
+#define RASTER_STATE 4
+#define RASTER_NAME RASTER_VARIANT(4)
+#include "raster_impl.h"
+#define RASTER_STATE 5
+#define RASTER_NAME RASTER_VARIANT(5)
+#include "raster_impl.h"
+#define RASTER_STATE 6
+#define RASTER_NAME RASTER_VARIANT(6)
+#include "raster_impl.h"
+#define RASTER_STATE 7
+#define RASTER_NAME RASTER_VARIANT(7)
+#include "raster_impl.h"
+
+#undef RASTER_VARIANT
+#undef RASTER_FORMAT
+#undef RASTER_DEPTH_T
+#undef RASTER_DEPTH_VALUE_T
+#undef RASTER_DEPTH_LOAD
+#undef RASTER_DEPTH_STORE
+#undef RASTER_DEPTH_ENCODE
+#undef RASTER_DEPTH_PASS
+#undef RASTER_DEPTH_CLIP
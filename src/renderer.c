@@ -1,5 +1,6 @@
 /* Implements renderer.h */
 #include <renderer.h>
+#include <kernels.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -7,15 +8,10 @@
 /* Consts */
 #define DIFFUSE 0.3
 #define AMBIENT 0.3
-
-/* Get max of three floats */
-static float max(float a, float b, float c) {
-  return a > b ? (a > c ? a : c) : (b > c ? b : c);
-}
-/* Get min of three floats */
-static float min(float a, float b, float c) {
-  return a < b ? (a < c ? a : c) : (b < c ? b : c);
-}
+/* Initial size of the frame arena, it grows to fit the biggest frame */
+#define ARENA_SIZE (1024 * 1024)
+/* Raster bands per worker, more balance better but cost more binning */
+#define BANDS_PER_WORKER 4
 
 /* Get r from rgb as float 0-1 */
 #define r(rgb) ((rgba >> 24) & 0xFF) / 255.0f
@@ -24,186 +20,674 @@ static float min(float a, float b, float c) {
 /* Get b from rgb as float 0-1 */
 #define b(rgb) ((rgba >> 8) & 0xFF) / 255.0f
 
-/* Create rgb from floats */
-static uint32_t rgb(float r, float g, float b) {
-  return (uint32_t)(r * 255) << 24 | (uint32_t)(g * 255) << 16 |
-    (uint32_t)(b * 255) << 8;
-}
-
-/* Rasterize a triangle */
-static void rasterize_triangle(
-    renderer_t *renderer,
-    tri_t *tri
-) {
-  /* Get bounds */
-  float xmin = min(tri->points[0].x, tri->points[1].x, tri->points[2].x);
-  float ymin = min(tri->points[0].y, tri->points[1].y, tri->points[2].y);
-  float xmax = max(tri->points[0].x, tri->points[1].x, tri->points[2].x);
-  float ymax = max(tri->points[0].y, tri->points[1].y, tri->points[2].y);
-  xmin--;
-  ymin--;
-  xmax++;
-  ymax++;
-  uint32_t x_min = xmin > 0 ? (uint32_t)xmin : 0;
-  uint32_t y_min = ymin > 0 ? (uint32_t)ymin : 0;
-  uint32_t x_max = xmax > 0 ? (uint32_t)xmax : 0;
-  uint32_t y_max = ymax > 0 ? (uint32_t)ymax : 0;
-  x_min = x_min >= renderer->width ? renderer->width - 1 : x_min;
-  y_min = y_min >= renderer->height ? renderer->height - 1 : y_min;
-  x_max = x_max >= renderer->width ? renderer->width - 1 : x_max;
-  y_max = y_max >= renderer->height ? renderer->height - 1 : y_max;
-
-  /* Precompute where possible */
-  vec2_t v0 = V2_FROM(
-      tri->points[1].x - tri->points[0].x,
-      tri->points[1].y - tri->points[0].y
-  );
-  vec2_t v1 = V2_FROM(
-      tri->points[2].x - tri->points[0].x,
-      tri->points[2].y - tri->points[0].y
-  );
-  vec2_t d0 = V2_FROM(v2dot(v0, v0), v2dot(v0, v1));
-  vec2_t d1 = V2_FROM(v2dot(v1, v0), v2dot(v1, v1));
-  float d = d0.x * d1.y - d0.y * d0.y;
-  if (d == 0) return;
-
-  for (uint32_t y = y_min; y < y_max; y++) {
-    bool row = false;
-    for (uint32_t x = x_min; x < x_max; x++) {
-      vec2_t v2 = V2_FROM(x-tri->points[0].x, y-tri->points[0].y);
-      vec2_t d2 = V2_FROM(v2dot(v2, v0), v2dot(v2, v1));
-
-      float v = (d1.y * d2.x - d0.y * d2.y) / d;
-      float w = (d0.x * d2.y - d0.y * d2.x) / d;
-      float u = 1 - v - w;
+/*
+ * Screen space triangles from one vertex job, binned by the bands they touch:
+ * band b's are tris[indices[starts[b]]] to tris[indices[starts[b + 1] - 1]]
+ */
+typedef struct {
+  const tri_t *tris;
+  uint32_t count;
+  uint32_t *starts, *indices;
+} run_t;
+/*
+ * A draw call (or clear), shared by its jobs. The vertex stage writes one run
+ * per job, which the raster stage reads in order.
+ */
+typedef struct {
+  renderer_t *renderer;
+  /* Model view and projection matrices */
+  m4x4_t view, proj;
+  /* Lighting terms and raster loop, from the pipeline state */
+  double ambient, diffuse;
+  /*
+   * Whether samples past the far plane are clipped (when depth is tested or
+   * written), so anything wholly past it can be culled
+   */
+  bool clip_far;
+  void (*rasterize)(renderer_t *, const tri_t *, const rect_t *);
+  /* Source, a mesh and its bounds, a quantized mesh or a heightfield */
+  const mesh_cache_t *cache;
+  /*
+   * The mesh's normals if they're current, and the columns of the view
+   * matrix's cofactor, which takes them to (unnormalized) view space normals
+   */
+  const vec3_t *normals;
+  vec3_t normal_axes[3];
+  const qmesh_t *qmesh;
+  const heightfield_t *heightfield;
+  /* Items (triangles, chunks or rows) per vertex job */
+  uint32_t grain;
+  /* Screen space triangle runs */
+  run_t *runs;
+  uint32_t num_runs;
+  /* Rows per band, the number of bands and the rect being cleared */
+  uint32_t band_rows, num_bands;
+  rect_t rect;
+} draw_t;
 
-      if (u >= 0 && v >= 0 && w >= 0) {
-        row = true;
-        vec3_t col = V3_FROM(
-            u*tri->cols[0].x + v*tri->cols[1].x + w*tri->cols[2].x,
-            u*tri->cols[0].y + v*tri->cols[1].y + w*tri->cols[2].y,
-            u*tri->cols[0].z + v*tri->cols[1].z + w*tri->cols[2].z
-        );
-        float z = u*tri->cols[0].z
-          + v*tri->cols[1].z
-          + w*tri->cols[2].z;
-        if (z < renderer->depthbuffer[y * renderer->width + x]) {
-          renderer->depthbuffer[y * renderer->width + x] = z;
-          renderer->framebuffer[y * renderer->width + x] =
-            rgb(col.x, col.y, col.z);
-        }
-      } else {
-        if (row) break;
-      }
-    }
+/*
+ * Depth buffer value of a view space z, before encoding. It's computed from
+ * 1/z directly (rather than from the projected z) so reversed z keeps its
+ * precision, and it's affine in screen space so it interpolates linearly.
+ */
+static float depth_value(const renderer_t *renderer, float z) {
+  float n = renderer->camera.near;
+  float f = renderer->camera.far;
+  float rz = 1 / -z;
+  switch (renderer->depth_format) {
+    case DEPTH_F32_REVERSED: return n / (f - n) * (f * rz - 1);
+    case DEPTH_UNORM16: return (f - f * n * rz) / (f - n) * DEPTH_UNORM16_MAX;
+    case DEPTH_UNORM24: return (f - f * n * rz) / (f - n) * DEPTH_UNORM24_MAX;
+    default: return (f - f * n * rz) / (f - n);
   }
 }
-static void draw_triangle(
-    renderer_t *renderer,
-    tri_t *tri
+/*
+ * Whether a screen space triangle's bounds hold any samples (integer
+ * coordinates) on screen, rasterization draws nothing for those that don't
+ */
+static bool has_samples(const renderer_t *renderer, const tri_t *tri) {
+  const vec3_t *p = tri->points;
+  float xmin = ceilf(fmaxf(fminf(fminf(p[0].x, p[1].x), p[2].x), 0));
+  float ymin = ceilf(fmaxf(fminf(fminf(p[0].y, p[1].y), p[2].y), 0));
+  float xmax = floorf(fminf(
+        fmaxf(fmaxf(p[0].x, p[1].x), p[2].x),
+        renderer->width - 1.0f
+  ));
+  float ymax = floorf(fminf(
+        fmaxf(fmaxf(p[0].y, p[1].y), p[2].y),
+        renderer->height - 1.0f
+  ));
+  return xmin <= xmax && ymin <= ymax;
+}
+/*
+ * Project a view space triangle to screen space and light it, facing is the z
+ * of its view space normal. Returns false if it's culled. tri and out may be
+ * the same.
+ */
+static bool project_triangle(
+    const draw_t *draw,
+    const tri_t *tri,
+    float facing,
+    tri_t *out
 ) {
-  /* Calculate normal */
-  vec3_t a = v3sub(tri->points[2], tri->points[0]);
-  vec3_t b = v3sub(tri->points[1], tri->points[0]);
-  vec3_t normal = v3normalize(v3cross(a, b));
   /* Cull if possible */
   /* Backface culling */
-  if (v3dot(normal, V3_FROM(0, 0, 1)) < 0) return;
+  if (facing < 0) return false;
   /* Cull behind camera */
   for (uint32_t i = 0; i < 3; i++) {
-    if (tri->points[i].z > 0) return;
+    if (tri->points[i].z > 0) return false;
+  }
+  /* Cull past the far plane, every sample would be clipped */
+  const renderer_t *renderer = draw->renderer;
+  float far = -renderer->camera.far;
+  if (draw->clip_far && tri->points[0].z < far && tri->points[1].z < far
+      && tri->points[2].z < far) {
+    return false;
   }
   /* Project */
-  m4x4_t proj = m4x4_perspective(
+  tri_t t;
+  for (uint32_t i = 0; i < 3; i++) {
+    vec3_t v = tri->points[i];
+    vec4_t p = m4x4v4_mul(draw->proj, V4_FROM(v.x, v.y, v.z, 1));
+    t.points[i] = V3_FROM(
+        (1+p.x/p.w) * renderer->width / 2,
+        (1+p.y/p.w) * renderer->height / 2,
+        depth_value(renderer, v.z)
+    );
+  }
+  /* Cull off screen and tiny triangles, so they don't take up scratch space */
+  if (!has_samples(renderer, &t)) return false;
+  /* Light */
+  float l = draw->ambient + draw->diffuse*facing;
+  for (uint32_t i = 0; i < 3; i++) {
+    t.cols[i] = V3_FROM(tri->cols[i].x*l, tri->cols[i].y*l, tri->cols[i].z*l);
+  }
+  *out = t;
+  return true;
+}
+/*
+ * Whether a box (in the space draw->view maps from) can be drawn in at all,
+ * false if its corners are all behind the camera, all past the same side of
+ * the screen or all past a clipping far plane, so every triangle in it would
+ * be culled or draw nothing anyway
+ */
+static bool box_visible(const draw_t *draw, vec3_t min, vec3_t max) {
+  uint32_t behind = 0, left = 0, right = 0, below = 0, above = 0, past = 0;
+  for (uint32_t i = 0; i < 8; i++) {
+    vec4_t p = m4x4v4_mul(draw->view, V4_FROM(
+        i & 1 ? max.x : min.x,
+        i & 2 ? max.y : min.y,
+        i & 4 ? max.z : min.z,
+        1
+    ));
+    behind += p.z > 0;
+    past += p.z < -draw->renderer->camera.far;
+    p = m4x4v4_mul(draw->proj, p);
+    left += p.x < -p.w;
+    right += p.x > p.w;
+    below += p.y < -p.w;
+    above += p.y > p.w;
+  }
+  if (draw->clip_far && past == 8) return false;
+  return behind < 8 && left < 8 && right < 8 && below < 8 && above < 8;
+}
+
+/* What a mesh's triangles come from */
+static const void *mesh_source(const mesh_t *mesh) {
+  if (mesh->heightfield) return mesh->heightfield;
+  return mesh->tris;
+}
+/* Number of triangles a mesh draws */
+static uint32_t mesh_tris(const mesh_t *mesh) {
+  const heightfield_t *heightfield = mesh->heightfield;
+  if (heightfield) return heightfield->width * heightfield->depth * 2;
+  return mesh->num_tris;
+}
+/* Rows of cells per heightfield block (vertex job), about MESH_CHUNK_TRIS */
+static uint32_t heightfield_block_rows(const heightfield_t *heightfield) {
+  uint32_t tris = heightfield->width * 2;
+  return tris && tris < MESH_CHUNK_TRIS ? MESH_CHUNK_TRIS / tris : 1;
+}
+/* Bounds of a heightfield and each block of it, in its own space */
+static void heightfield_bounds(
+    const heightfield_t *heightfield,
+    mesh_cache_t *cache,
+    uint32_t blocks
+) {
+  uint32_t rows = heightfield_block_rows(heightfield);
+  size_t pitch = heightfield->width + 1;
+  cache->min = V3_FROM(INF, INF, INF);
+  cache->max = V3_FROM(-INF, -INF, -INF);
+  for (uint32_t b = 0; b < blocks; b++) {
+    uint32_t z0 = b * rows;
+    uint32_t z1 = z0 + rows;
+    if (z1 > heightfield->depth) z1 = heightfield->depth;
+    /* The block's cells use the points of rows z0 to z1, inclusive */
+    float ymin = INF, ymax = -INF;
+    for (size_t i = z0 * pitch; i < (z1 + 1) * pitch; i++) {
+      ymin = fminf(ymin, heightfield->heights[i]);
+      ymax = fmaxf(ymax, heightfield->heights[i]);
+    }
+    cache->chunk_min[b] = V3_FROM(0, ymin, z0);
+    cache->chunk_max[b] = V3_FROM(heightfield->width, ymax, z1);
+    for (uint32_t k = 0; k < 3; k++) {
+      cache->min.v[k] = fminf(cache->min.v[k], cache->chunk_min[b].v[k]);
+      cache->max.v[k] = fmaxf(cache->max.v[k], cache->chunk_max[b].v[k]);
+    }
+  }
+}
+/* Free a mesh cache's chunk bounds */
+static void free_cache(mesh_cache_t *cache) {
+  free(cache->chunk_min);
+  free(cache->chunk_max);
+  cache->chunk_min = NULL;
+  cache->chunk_max = NULL;
+  cache->capacity = 0;
+}
+/* Get the bounds cache of a mesh, rebuilding it if it's stale */
+static mesh_cache_t *get_cache(renderer_t *renderer, const mesh_t *mesh) {
+  mesh_cache_t *cache = NULL;
+  for (uint32_t i = 0; i < renderer->num_caches; i++) {
+    if (renderer->caches[i].mesh == mesh) {
+      cache = &renderer->caches[i];
+      break;
+    }
+  }
+  if (!cache) {
+    mesh_cache_t *caches = realloc(
+        renderer->caches,
+        (renderer->num_caches + 1) * sizeof(mesh_cache_t)
+    );
+    if (!caches) return NULL;
+    renderer->caches = caches;
+    cache = &caches[renderer->num_caches++];
+    memset(cache, 0, sizeof(*cache));
+    cache->mesh = mesh;
+  } else if (cache->valid && cache->version == mesh->version
+      && cache->source == mesh_source(mesh)
+      && cache->num_tris == mesh_tris(mesh)) {
+    return cache;
+  }
+
+  /* Rebuild */
+  cache->valid = false;
+  cache->version = mesh->version;
+  cache->source = mesh_source(mesh);
+  cache->num_tris = mesh_tris(mesh);
+  const heightfield_t *heightfield = mesh->heightfield;
+  uint32_t rows = heightfield ? heightfield_block_rows(heightfield) : 0;
+  uint32_t chunks = heightfield
+    ? (heightfield->depth + rows - 1) / rows
+    : (mesh->num_tris + MESH_CHUNK_TRIS - 1) / MESH_CHUNK_TRIS;
+  if (cache->capacity < chunks) {
+    free_cache(cache);
+    cache->chunk_min = malloc(chunks * sizeof(vec3_t));
+    cache->chunk_max = malloc(chunks * sizeof(vec3_t));
+    if (!cache->chunk_min || !cache->chunk_max) {
+      free_cache(cache);
+      return NULL;
+    }
+    cache->capacity = chunks;
+  }
+  if (heightfield) {
+    heightfield_bounds(heightfield, cache, chunks);
+    cache->valid = true;
+    return cache;
+  }
+  cache->min = V3_FROM(INF, INF, INF);
+  cache->max = V3_FROM(-INF, -INF, -INF);
+  for (uint32_t c = 0; c < chunks; c++) {
+    uint32_t first = c * MESH_CHUNK_TRIS;
+    uint32_t last = first + MESH_CHUNK_TRIS;
+    if (last > mesh->num_tris) last = mesh->num_tris;
+    vec3_t lo = V3_FROM(INF, INF, INF);
+    vec3_t hi = V3_FROM(-INF, -INF, -INF);
+    for (uint32_t i = first; i < last; i++) {
+      for (uint32_t j = 0; j < 3; j++) {
+        for (uint32_t k = 0; k < 3; k++) {
+          lo.v[k] = fminf(lo.v[k], mesh->tris[i].points[j].v[k]);
+          hi.v[k] = fmaxf(hi.v[k], mesh->tris[i].points[j].v[k]);
+        }
+      }
+    }
+    cache->chunk_min[c] = lo;
+    cache->chunk_max[c] = hi;
+    for (uint32_t k = 0; k < 3; k++) {
+      cache->min.v[k] = fminf(cache->min.v[k], lo.v[k]);
+      cache->max.v[k] = fmaxf(cache->max.v[k], hi.v[k]);
+    }
+  }
+  cache->valid = true;
+  return cache;
+}
+/* Perspective projection matrix of the camera */
+static m4x4_t projection(const renderer_t *renderer) {
+  return m4x4_perspective(
       renderer->camera.fov,
       (float)(renderer->width)/(float)(renderer->height),
       renderer->camera.near,
       renderer->camera.far
   );
-  vec4_t p0 = V4_FROM(tri->points[0].x, tri->points[0].y, tri->points[0].z, 1);
-  vec4_t p1 = V4_FROM(tri->points[1].x, tri->points[1].y, tri->points[1].z, 1);
-  vec4_t p2 = V4_FROM(tri->points[2].x, tri->points[2].y, tri->points[2].z, 1);
-  p0 = m4x4v4_mul(proj, p0);
-  p1 = m4x4v4_mul(proj, p1);
-  p2 = m4x4v4_mul(proj, p2);
-  vec3_t proj_points[3];
-  proj_points[0] = V3_FROM(p0.x/p0.w, p0.y/p0.w, p0.z/p0.w);
-  proj_points[1] = V3_FROM(p1.x/p1.w, p1.y/p1.w, p1.z/p1.w);
-  proj_points[2] = V3_FROM(p2.x/p2.w, p2.y/p2.w, p2.z/p2.w);
-  proj_points[0].x = (1+proj_points[0].x) * renderer->width / 2;
-  proj_points[0].y = (1+proj_points[0].y) * renderer->height / 2;
-  proj_points[1].x = (1+proj_points[1].x) * renderer->width / 2;
-  proj_points[1].y = (1+proj_points[1].y) * renderer->height / 2;
-  proj_points[2].x = (1+proj_points[2].x) * renderer->width / 2;
-  proj_points[2].y = (1+proj_points[2].y) * renderer->height / 2;
-  float l = AMBIENT + DIFFUSE*(v3dot(normal, V3_FROM(0, 0, 1)));
-  vec3_t cols[3];
-  cols[0] = V3_FROM(tri->cols[0].x*l, tri->cols[0].y*l, tri->cols[0].z*l);
-  cols[1] = V3_FROM(tri->cols[1].x*l, tri->cols[1].y*l, tri->cols[1].z*l);
-  cols[2] = V3_FROM(tri->cols[2].x*l, tri->cols[2].y*l, tri->cols[2].z*l);
-  /* Render */
-  tri_t t;
-  t.points[0] = proj_points[0];
-  t.points[1] = proj_points[1];
-  t.points[2] = proj_points[2];
-  t.cols[0] = cols[0];
-  t.cols[1] = cols[1];
-  t.cols[2] = cols[2];
-  rasterize_triangle(renderer, &t);
-}
-static void tri_transform(
-    tri_t *tri,
-    vec3_t translate,
-    vec3_t scale,
-    vec3_t rotate
+}
+/* Whether a rect is empty */
+static bool rect_empty(rect_t r) {
+  return r.x0 >= r.x1 || r.y0 >= r.y1;
+}
+/* Smallest rect containing two rects */
+static rect_t rect_union(rect_t a, rect_t b) {
+  if (rect_empty(a)) return b;
+  if (rect_empty(b)) return a;
+  return (rect_t){
+    a.x0 < b.x0 ? a.x0 : b.x0,
+    a.y0 < b.y0 ? a.y0 : b.y0,
+    a.x1 > b.x1 ? a.x1 : b.x1,
+    a.y1 > b.y1 ? a.y1 : b.y1,
+  };
+}
+/* Whether two rects overlap */
+static bool rect_overlaps(rect_t a, rect_t b) {
+  return a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+}
+/* Rows per raster band, whole tiles so no two bands share one */
+static uint32_t band_rows(const renderer_t *renderer) {
+  uint32_t bands = renderer->jobs.num_workers * BANDS_PER_WORKER;
+  uint32_t tiles = (renderer->tiles_y + bands - 1) / bands;
+  return (tiles ? tiles : 1) * TILE_SIZE;
+}
+/* Number of bands covering the frame */
+static uint32_t num_bands(const renderer_t *renderer, uint32_t rows) {
+  return (renderer->height + rows - 1) / rows;
+}
+/* Part of a rect inside a band */
+static rect_t band_rect(rect_t rect, uint32_t rows, uint32_t band) {
+  uint32_t y0 = band * rows;
+  uint32_t y1 = y0 + rows;
+  return (rect_t){
+    rect.x0,
+    rect.y0 > y0 ? rect.y0 : y0,
+    rect.x1,
+    rect.y1 < y1 ? rect.y1 : y1,
+  };
+}
+/* Clear bands of draw->rect */
+static void clear_job(
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    uint32_t worker
 ) {
-  m4x4_t rot = m4x4_euler(rotate.x, rotate.y, rotate.z);
-  vec4_t p0 = V4_FROM(tri->points[0].x, tri->points[0].y, tri->points[0].z, 1);
-  vec4_t p1 = V4_FROM(tri->points[1].x, tri->points[1].y, tri->points[1].z, 1);
-  vec4_t p2 = V4_FROM(tri->points[2].x, tri->points[2].y, tri->points[2].z, 1);
-  p0 = m4x4v4_mul(rot, p0);
-  p1 = m4x4v4_mul(rot, p1);
-  p2 = m4x4v4_mul(rot, p2);
-  tri->points[0] = V3_FROM(p0.x, p0.y, p0.z);
-  tri->points[1] = V3_FROM(p1.x, p1.y, p1.z);
-  tri->points[2] = V3_FROM(p2.x, p2.y, p2.z);
-  tri->points[0] = v3scale(tri->points[0], scale.x);
-  tri->points[1] = v3scale(tri->points[1], scale.y);
-  tri->points[2] = v3scale(tri->points[2], scale.z);
-  tri->points[0] = v3add(tri->points[0], translate);
-  tri->points[1] = v3add(tri->points[1], translate);
-  tri->points[2] = v3add(tri->points[2], translate);
-}
-/* Apply a matrix */
-static void apply_matrix(
-  tri_t *tri,
-  m4x4_t m
+  draw_t *draw = data;
+  (void)worker;
+  for (uint32_t i = begin; i < end; i++) {
+    rect_t band = band_rect(draw->rect, draw->band_rows, i);
+    if (rect_empty(band)) continue;
+    draw->renderer->kernels->clear(draw->renderer, band);
+  }
+}
+/* Clear a rect of the frame and depth buffers, one band per job */
+static void clear_rect(renderer_t *renderer, rect_t rect) {
+  draw_t draw = { .renderer = renderer, .rect = rect };
+  draw.band_rows = band_rows(renderer);
+  jobs_parallel_for(
+      &renderer->jobs,
+      clear_job,
+      &draw,
+      num_bands(renderer, draw.band_rows),
+      1
+  );
+}
+/*
+ * Project a run of view space triangles in place, returns how many are kept.
+ * facing is each one's view space normal z, worked out here if it's NULL.
+ */
+static uint32_t project_run(
+    const draw_t *draw,
+    tri_t *tris,
+    const float *facing,
+    uint32_t count
+) {
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    float f = facing ? facing[i] : tri_normal(&tris[i]).z;
+    kept += project_triangle(draw, &tris[i], f, &tris[kept]);
+  }
+  return kept;
+}
+/*
+ * Bands a screen space triangle has samples in, false if none (the rows it
+ * covers are snapped inwards the same way rasterization does)
+ */
+static bool tri_bands(
+    const draw_t *draw,
+    const tri_t *tri,
+    uint32_t *first,
+    uint32_t *last
 ) {
-  vec4_t p0 = V4_FROM(tri->points[0].x, tri->points[0].y, tri->points[0].z, 1);
-  vec4_t p1 = V4_FROM(tri->points[1].x, tri->points[1].y, tri->points[1].z, 1);
-  vec4_t p2 = V4_FROM(tri->points[2].x, tri->points[2].y, tri->points[2].z, 1);
-  p0 = m4x4v4_mul(m, p0);
-  p1 = m4x4v4_mul(m, p1);
-  p2 = m4x4v4_mul(m, p2);
-  tri->points[0] = V3_FROM(p0.x, p0.y, p0.z);
-  tri->points[1] = V3_FROM(p1.x, p1.y, p1.z);
-  tri->points[2] = V3_FROM(p2.x, p2.y, p2.z);
+  const vec3_t *p = tri->points;
+  float ymin = fminf(fminf(p[0].y, p[1].y), p[2].y);
+  float ymax = fmaxf(fmaxf(p[0].y, p[1].y), p[2].y);
+  ymin = ceilf(fmaxf(ymin, 0));
+  ymax = floorf(fminf(ymax, draw->renderer->height - 1.0f));
+  if (!(ymin <= ymax)) return false;
+  *first = (uint32_t)ymin / draw->band_rows;
+  *last = (uint32_t)ymax / draw->band_rows;
+  return true;
 }
-
-/* Create renderer */
-void renderer_create(
+/*
+ * Bin a run's triangles by band (in the worker's arena), so each raster job
+ * only goes through its own. The run is dropped if there's no memory for it.
+ */
+static void bin_run(const draw_t *draw, run_t *run, arena_t *arena) {
+  uint32_t bands = draw->num_bands;
+  uint32_t *starts = arena_alloc(arena, (bands + 1) * sizeof(uint32_t));
+  if (!starts) {
+    run->count = 0;
+    return;
+  }
+  /* Count each band's triangles, then make the counts offsets */
+  memset(starts, 0, (bands + 1) * sizeof(uint32_t));
+  uint32_t first, last;
+  for (uint32_t t = 0; t < run->count; t++) {
+    if (!tri_bands(draw, &run->tris[t], &first, &last)) continue;
+    for (uint32_t b = first; b <= last; b++) starts[b + 1]++;
+  }
+  for (uint32_t b = 0; b < bands; b++) starts[b + 1] += starts[b];
+  uint32_t *indices = arena_alloc(arena, starts[bands] * sizeof(uint32_t));
+  if (!indices) {
+    run->count = 0;
+    return;
+  }
+  /* Fill them, each start moves up to the next band's, then move them back */
+  for (uint32_t t = 0; t < run->count; t++) {
+    if (!tri_bands(draw, &run->tris[t], &first, &last)) continue;
+    for (uint32_t b = first; b <= last; b++) indices[starts[b]++] = t;
+  }
+  for (uint32_t b = bands; b > 0; b--) starts[b] = starts[b - 1];
+  starts[0] = 0;
+  run->starts = starts;
+  run->indices = indices;
+}
+/*
+ * Finish a run of view space triangles, the last allocation from the worker's
+ * arena: project them, give back the scratch of the culled ones and bin the
+ * rest
+ */
+static void finish_run(
+    const draw_t *draw,
+    run_t *run,
+    arena_t *arena,
+    tri_t *tris,
+    const float *facing,
+    uint32_t count
+) {
+  run->count = project_run(draw, tris, facing, count);
+  run->tris = arena_trim(arena, tris, run->count * sizeof(tri_t));
+  bin_run(draw, run, arena);
+}
+/* Vertex stage of a mesh, one run per MESH_CHUNK_TRIS triangles */
+static void vertex_job(
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    uint32_t worker
+) {
+  draw_t *draw = data;
+  renderer_t *renderer = draw->renderer;
+  const mesh_cache_t *cache = draw->cache;
+  uint32_t chunk = begin / draw->grain;
+  run_t *run = &draw->runs[chunk];
+  run->count = 0;
+  /* Skip the whole chunk if it's off screen */
+  if (!box_visible(draw, cache->chunk_min[chunk], cache->chunk_max[chunk])) {
+    return;
+  }
+  arena_t *arena = jobs_arena(&renderer->jobs, worker);
+  uint32_t count = end - begin;
+  tri_t *tris = arena_alloc(arena, count * sizeof(tri_t));
+  if (!tris) return;
+  const tri_t *src = &cache->mesh->tris[begin];
+  if (!draw->normals) {
+    /* Straight from the shared mesh, to view space with its model matrix */
+    memcpy(tris, src, count * sizeof(tri_t));
+    renderer->kernels->transform(tris, count, &draw->view);
+    finish_run(draw, run, arena, tris, NULL, count);
+    return;
+  }
+  /* Cull backfaces with the cached normals first, only copy the rest */
+  float facing[MESH_CHUNK_TRIS];
+  uint32_t kept = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    vec3_t n = draw->normals[begin + i];
+    vec3_t v = v3add(
+        v3add(
+            v3scale(draw->normal_axes[0], n.x),
+            v3scale(draw->normal_axes[1], n.y)
+        ),
+        v3scale(draw->normal_axes[2], n.z)
+    );
+    if (v.z < 0) continue;
+    tris[kept] = src[i];
+    facing[kept++] = v3normalize(v).z;
+  }
+  renderer->kernels->transform(tris, kept, &draw->view);
+  finish_run(draw, run, arena, tris, facing, kept);
+}
+/* Vertex stage of a quantized mesh, one run per chunk, decoding as we go */
+static void vertex_job_quantized(
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    uint32_t worker
+) {
+  draw_t *draw = data;
+  renderer_t *renderer = draw->renderer;
+  arena_t *arena = jobs_arena(&renderer->jobs, worker);
+  for (uint32_t c = begin; c < end; c++) {
+    const qchunk_t *chunk = &draw->qmesh->chunks[c];
+    const qtri_t *qtris = &draw->qmesh->tris[chunk->first_tri];
+    run_t *run = &draw->runs[c];
+    run->count = 0;
+    vec3_t hi = v3add(chunk->origin, v3scale(chunk->scale, QMESH_POS_MAX));
+    if (!box_visible(draw, chunk->origin, hi)) continue;
+    tri_t *tris = arena_alloc(arena, chunk->num_tris * sizeof(tri_t));
+    if (!tris) continue;
+    for (uint32_t i = 0; i < chunk->num_tris; i++) {
+      qtri_decode(chunk, &qtris[i], &tris[i]);
+    }
+    renderer->kernels->transform(tris, chunk->num_tris, &draw->view);
+    finish_run(draw, run, arena, tris, NULL, chunk->num_tris);
+  }
+}
+/*
+ * Vertex stage of a heightfield, one run per block of draw->grain rows of
+ * cells. Only the block being worked on is ever in scratch memory whole, the
+ * runs keep just the triangles that weren't culled.
+ */
+static void vertex_job_heightfield(
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    uint32_t worker
+) {
+  draw_t *draw = data;
+  renderer_t *renderer = draw->renderer;
+  const heightfield_t *heightfield = draw->heightfield;
+  const mesh_cache_t *cache = draw->cache;
+  uint32_t block = begin / draw->grain;
+  run_t *run = &draw->runs[block];
+  run->count = 0;
+  /* Skip the whole block if it's off screen */
+  if (!box_visible(draw, cache->chunk_min[block], cache->chunk_max[block])) {
+    return;
+  }
+  arena_t *arena = jobs_arena(&renderer->jobs, worker);
+  uint32_t count = (end - begin) * heightfield->width * 2;
+  tri_t *tris = arena_alloc(arena, count * sizeof(tri_t));
+  if (!tris) return;
+  /* Generate the rows' triangles straight into scratch memory */
+  tri_t *tri = tris;
+  for (uint32_t z = begin; z < end; z++) {
+    for (uint32_t x = 0; x < heightfield->width; x++, tri += 2) {
+      heightfield_cell(heightfield, x, z, tri);
+    }
+  }
+  renderer->kernels->transform(tris, count, &draw->view);
+  finish_run(draw, run, arena, tris, NULL, count);
+}
+/*
+ * Raster stage, one band of the scissor rect per job. Every band goes through
+ * its bin of each run in order, so pixels see triangles in submission order.
+ */
+static void raster_job(
+    void *data,
+    uint32_t begin,
+    uint32_t end,
+    uint32_t worker
+) {
+  draw_t *draw = data;
+  renderer_t *renderer = draw->renderer;
+  (void)worker;
+  for (uint32_t i = begin; i < end; i++) {
+    rect_t band = band_rect(renderer->scissor, draw->band_rows, i);
+    if (rect_empty(band)) continue;
+    for (uint32_t r = 0; r < draw->num_runs; r++) {
+      const run_t *run = &draw->runs[r];
+      if (!run->count) continue;
+      for (uint32_t k = run->starts[i]; k < run->starts[i + 1]; k++) {
+        draw->rasterize(renderer, &run->tris[run->indices[k]], &band);
+      }
+    }
+  }
+}
+/* Run a draw call's vertex stage over [0, count), then its raster stage */
+static void draw_stages(
+    renderer_t *renderer,
+    draw_t *draw,
+    job_fn_t vertex,
+    uint32_t count,
+    uint32_t grain
+) {
+  /* Specialize for the pipeline state once per draw */
+  bool lit = renderer->pipeline & PIPELINE_LIGHTING;
+  draw->ambient = lit ? AMBIENT : 1;
+  draw->diffuse = lit ? DIFFUSE : 0;
+  draw->clip_far = renderer->pipeline
+    & (PIPELINE_DEPTH_TEST | PIPELINE_DEPTH_WRITE);
+  draw->rasterize = renderer->kernels->rasterize[renderer->depth_format]
+    [renderer->pipeline & PIPELINE_RASTER_MASK];
+  draw->band_rows = band_rows(renderer);
+  draw->num_bands = num_bands(renderer, draw->band_rows);
+  jobs_parallel_for(&renderer->jobs, vertex, draw, count, grain);
+  jobs_parallel_for(&renderer->jobs, raster_job, draw, draw->num_bands, 1);
+}
+/* (Re)allocate the frame and depth buffers for the current size */
+static void alloc_buffers(renderer_t *renderer) {
+  renderer->tiles_x = (renderer->width + TILE_MASK) >> TILE_SHIFT;
+  renderer->tiles_y = (renderer->height + TILE_MASK) >> TILE_SHIFT;
+  size_t count = (size_t)renderer->tiles_x * renderer->tiles_y * TILE_PIXELS;
+  free(renderer->framebuffer);
+  free(renderer->depthbuffer);
+  /* Tiles are a multiple of the cache line size, so align to one */
+  renderer->framebuffer = aligned_alloc(ARENA_ALIGN, count * sizeof(uint32_t));
+  size_t depth_size = depth_format_size(renderer->depth_format);
+  renderer->depthbuffer = aligned_alloc(ARENA_ALIGN, count * depth_size);
+  renderer->scissor = (rect_t){ 0, 0, renderer->width, renderer->height };
+  clear_rect(renderer, renderer->scissor);
+}
+/* Model matrix of a mesh's translate, scale and rotate */
+m4x4_t model_matrix(vec3_t translate, vec3_t scale, vec3_t rotate) {
+  m4x4_t m = m4x4_euler(rotate.x, rotate.y, rotate.z);
+  m = m4x4_mul(m4x4_scale(scale), m);
+  m = m4x4_mul(m4x4_translation(translate), m);
+  return m;
+}
+/* Size of a depth format's buffer element */
+size_t depth_format_size(depth_format_t format) {
+  switch (format) {
+    case DEPTH_UNORM16: return sizeof(uint16_t);
+    case DEPTH_UNORM24: return sizeof(depth24_t);
+    default: return sizeof(float);
+  }
+}
+/* Write a depth format's clear value (behind everything) to an element */
+void depth_format_clear(depth_format_t format, void *element) {
+  switch (format) {
+    case DEPTH_F32_REVERSED: {
+      float z = -INF;
+      memcpy(element, &z, sizeof(z));
+      break;
+    }
+    case DEPTH_UNORM16: {
+      uint16_t z = DEPTH_UNORM16_MAX;
+      memcpy(element, &z, sizeof(z));
+      break;
+    }
+    case DEPTH_UNORM24:
+      DEPTH24_STORE((depth24_t *)element, DEPTH_UNORM24_MAX);
+      break;
+    default: {
+      float z = INF;
+      memcpy(element, &z, sizeof(z));
+      break;
+    }
+  }
+}
+/* Create renderer, with a number of worker threads (0 for one per cpu) */
+bool renderer_create(
     renderer_t *renderer,
     uint32_t width,
-    uint32_t height
+    uint32_t height,
+    uint32_t threads
 ) {
   renderer->width = width;
   renderer->height = height;
-  renderer->framebuffer = malloc(width * height * sizeof(uint32_t));
-  memset(renderer->framebuffer, 0, width * height * sizeof(uint32_t));
-  renderer->depthbuffer = malloc(width * height * sizeof(float));
-  for (uint32_t i = 0; i < width * height; i++) {
-    renderer->depthbuffer[i] = INF;
-  }
+  renderer->kernels = kernels_select();
+  /* Every stage runs on the workers, there's nothing to fall back to */
+  if (!jobs_create(&renderer->jobs, threads)) return false;
+  renderer->framebuffer = NULL;
+  renderer->depthbuffer = NULL;
+  renderer->depth_format = DEPTH_F32;
+  alloc_buffers(renderer);
   renderer->camera.pos = V3_FROM(0, 0, 0);
   renderer->camera.forward = V3_FROM(0, 0, -1);
   renderer->camera.up = V3_FROM(0, 1, 0);
@@ -212,11 +696,41 @@ void renderer_create(
   renderer->camera.far = 100;
   renderer->camera.pitch = 0;
   renderer->camera.yaw = -90;
+  renderer->pipeline = PIPELINE_DEFAULT;
+  arena_create(&renderer->arena, ARENA_SIZE);
+  renderer->caches = NULL;
+  renderer->num_caches = 0;
+  memset(&renderer->last_frame, 0, sizeof(renderer->last_frame));
+  return true;
 }
 /* Destroy renderer */
 void renderer_destroy(renderer_t *renderer) {
   free(renderer->framebuffer);
   free(renderer->depthbuffer);
+  arena_destroy(&renderer->arena);
+  jobs_destroy(&renderer->jobs);
+  for (uint32_t i = 0; i < renderer->num_caches; i++) {
+    free_cache(&renderer->caches[i]);
+  }
+  free(renderer->caches);
+  free(renderer->last_frame.meshes);
+}
+/* Change the number of worker threads (0 for one per cpu) */
+bool renderer_set_threads(renderer_t *renderer, uint32_t threads) {
+  jobs_destroy(&renderer->jobs);
+  if (jobs_create(&renderer->jobs, threads)) return true;
+  /* Keep going on this thread alone if we can */
+  jobs_create(&renderer->jobs, 1);
+  return false;
+}
+/* Drop the cached bounds of a mesh */
+void renderer_forget(renderer_t *renderer, const mesh_t *mesh) {
+  for (uint32_t i = 0; i < renderer->num_caches; i++) {
+    if (renderer->caches[i].mesh != mesh) continue;
+    free_cache(&renderer->caches[i]);
+    renderer->caches[i] = renderer->caches[--renderer->num_caches];
+    return;
+  }
 }
 /* Resize renderer */
 void renderer_resize(
@@ -226,27 +740,31 @@ void renderer_resize(
 ) {
   renderer->width = width;
   renderer->height = height;
-  renderer->framebuffer =
-    realloc(renderer->framebuffer, width * height * sizeof(uint32_t));
-  memset(renderer->framebuffer, 0, width * height * sizeof(uint32_t));
-  renderer->depthbuffer =
-    realloc(renderer->depthbuffer, width * height * sizeof(float));
-  memset(renderer->depthbuffer, 0, width * height * sizeof(float));
-}
-/* Clear frame and depth buffer */
+  alloc_buffers(renderer);
+  renderer->last_frame.valid = false;
+}
+/* Change the depth buffer format (clears the depth buffer) */
+void renderer_set_depth_format(
+    renderer_t *renderer,
+    depth_format_t format
+) {
+  renderer->depth_format = format;
+  alloc_buffers(renderer);
+  renderer->last_frame.valid = false;
+}
+/* Clear frame and depth buffer, starts a new frame */
 void renderer_clear(renderer_t *renderer) {
-  memset(
-      renderer->framebuffer,
-      0,
-      renderer->width * renderer->height * sizeof(uint32_t)
-  );
-  for (uint32_t i = 0; i < renderer->width * renderer->height; i++) {
-    renderer->depthbuffer[i] = INF;
-  }
+  arena_reset(&renderer->arena);
+  jobs_reset(&renderer->jobs);
+  renderer->last_frame.valid = false;
+  clear_rect(renderer, (rect_t){ 0, 0, renderer->width, renderer->height });
 }
-/* Render mesh */
-void renderer_draw(renderer_t *renderer, mesh_t *mesh) {
-  /* Update camera */
+/* Copy the finished frame out, pitch is in bytes */
+void renderer_resolve(renderer_t *renderer, uint32_t *dst, size_t pitch) {
+  renderer->kernels->resolve(renderer, dst, pitch);
+}
+/* Update camera, returns the view matrix */
+static m4x4_t update_camera(renderer_t *renderer) {
   float pitch = renderer->camera.pitch * (PI/180);
   float yaw = renderer->camera.yaw * (PI/180);
   renderer->camera.forward = v3normalize(
@@ -256,18 +774,221 @@ void renderer_draw(renderer_t *renderer, mesh_t *mesh) {
           sinf(yaw) * cosf(pitch)
       )
   );
-  /* Draw */
-  for (uint32_t i = 0; i < mesh->num_tris; i++) {
-    tri_t tri = mesh->tris[i];
-    /* Transform */
-    tri_transform(&tri, mesh->translate, mesh->scale, mesh->rotate);
-    /* Apply camera matrix */
-    apply_matrix(&tri, m4x4_look_at(
+  return m4x4_look_at(
       renderer->camera.pos,
       v3add(renderer->camera.pos, renderer->camera.forward),
       renderer->camera.up
-    ));
-    /* Draw */
-    draw_triangle(renderer, &tri);
+  );
+}
+/* Whether two cameras would render the same */
+static bool camera_equal(const camera_t *a, const camera_t *b) {
+  return a->pos.x == b->pos.x && a->pos.y == b->pos.y && a->pos.z == b->pos.z
+    && a->up.x == b->up.x && a->up.y == b->up.y && a->up.z == b->up.z
+    && a->fov == b->fov && a->pitch == b->pitch && a->yaw == b->yaw
+    && a->near == b->near && a->far == b->far;
+}
+/* Screen rect a mesh can touch, from its bounds */
+static rect_t mesh_rect(
+    renderer_t *renderer,
+    const mesh_t *mesh,
+    const m4x4_t *view,
+    const m4x4_t *proj
+) {
+  rect_t full = { 0, 0, renderer->width, renderer->height };
+  mesh_cache_t *cache = get_cache(renderer, mesh);
+  if (!cache) return full;
+  if (!cache->num_tris) return (rect_t){ 0, 0, 0, 0 };
+  m4x4_t model_view = m4x4_mul(
+      *view,
+      model_matrix(mesh->translate, mesh->scale, mesh->rotate)
+  );
+  float xmin = INF, ymin = INF, xmax = -INF, ymax = -INF;
+  for (uint32_t i = 0; i < 8; i++) {
+    vec4_t p = V4_FROM(
+        i & 1 ? cache->max.x : cache->min.x,
+        i & 2 ? cache->max.y : cache->min.y,
+        i & 4 ? cache->max.z : cache->min.z,
+        1
+    );
+    p = m4x4v4_mul(model_view, p);
+    /* Too close to (or behind) the camera to project, could be anywhere */
+    if (p.z > -renderer->camera.near) return full;
+    p = m4x4v4_mul(*proj, p);
+    float x = (1+p.x/p.w) * renderer->width / 2;
+    float y = (1+p.y/p.w) * renderer->height / 2;
+    xmin = fminf(xmin, x);
+    ymin = fminf(ymin, y);
+    xmax = fmaxf(xmax, x);
+    ymax = fmaxf(ymax, y);
+  }
+  /*
+   * Rasterization covers the samples inside a triangle's bounds, the max
+   * edge included while a rect's is not, so pad by a pixel (which also covers
+   * rounding between this projection and the vertex stage's)
+   */
+  xmin = fmaxf(xmin - 1, 0);
+  ymin = fmaxf(ymin - 1, 0);
+  xmax = fminf(xmax + 1, renderer->width);
+  ymax = fminf(ymax + 1, renderer->height);
+  if (!(xmin < xmax && ymin < ymax)) return (rect_t){ 0, 0, 0, 0 };
+  return (rect_t){
+    (uint32_t)xmin,
+    (uint32_t)ymin,
+    (uint32_t)ceilf(xmax),
+    (uint32_t)ceilf(ymax),
+  };
+}
+/* Render a frame of meshes, skipping work that hasn't changed */
+bool renderer_render(
+    renderer_t *renderer,
+    const mesh_t *const *meshes,
+    uint32_t num_meshes
+) {
+  frame_state_t *last = &renderer->last_frame;
+  bool full = !last->valid
+    || last->width != renderer->width
+    || last->height != renderer->height
+    || last->num_meshes != num_meshes
+    || last->pipeline != renderer->pipeline
+    || !camera_equal(&last->camera, &renderer->camera);
+  for (uint32_t i = 0; !full && i < num_meshes; i++) {
+    full = last->meshes[i].mesh != meshes[i];
+  }
+  if (last->capacity < num_meshes) {
+    mesh_state_t *states =
+      realloc(last->meshes, num_meshes * sizeof(mesh_state_t));
+    if (!states) {
+      renderer_clear(renderer);
+      for (uint32_t i = 0; i < num_meshes; i++) {
+        renderer_draw(renderer, meshes[i]);
+      }
+      return true;
+    }
+    last->meshes = states;
+    last->capacity = num_meshes;
+  }
+
+  /* Find what changed */
+  m4x4_t view = update_camera(renderer);
+  m4x4_t proj = projection(renderer);
+  rect_t dirty = { 0, 0, 0, 0 };
+  for (uint32_t i = 0; i < num_meshes; i++) {
+    mesh_state_t *state = &last->meshes[i];
+    if (!full && state->version == meshes[i]->version) continue;
+    rect_t rect = mesh_rect(renderer, meshes[i], &view, &proj);
+    if (!full) dirty = rect_union(dirty, rect_union(state->rect, rect));
+    *state = (mesh_state_t){ meshes[i], meshes[i]->version, rect };
+  }
+  if (!full && rect_empty(dirty)) return false;
+
+  /* Draw */
+  if (full) {
+    renderer_clear(renderer);
+    for (uint32_t i = 0; i < num_meshes; i++) {
+      renderer_draw(renderer, meshes[i]);
+    }
+  } else {
+    arena_reset(&renderer->arena);
+    jobs_reset(&renderer->jobs);
+    clear_rect(renderer, dirty);
+    renderer->scissor = dirty;
+    for (uint32_t i = 0; i < num_meshes; i++) {
+      if (rect_overlaps(last->meshes[i].rect, dirty)) {
+        renderer_draw(renderer, meshes[i]);
+      }
+    }
+    renderer->scissor = (rect_t){ 0, 0, renderer->width, renderer->height };
   }
+  last->valid = true;
+  last->camera = renderer->camera;
+  last->pipeline = renderer->pipeline;
+  last->width = renderer->width;
+  last->height = renderer->height;
+  last->num_meshes = num_meshes;
+  return true;
+}
+/* Render a heightfield mesh */
+static void draw_heightfield(renderer_t *renderer, const mesh_t *mesh) {
+  const heightfield_t *heightfield = mesh->heightfield;
+  if (!heightfield->width) return;
+  mesh_cache_t *cache = get_cache(renderer, mesh);
+  if (!cache) return;
+  draw_t draw = {
+    .renderer = renderer,
+    .view = m4x4_mul(
+        update_camera(renderer),
+        model_matrix(mesh->translate, mesh->scale, mesh->rotate)
+    ),
+    .proj = projection(renderer),
+    .cache = cache,
+    .heightfield = heightfield,
+    .grain = heightfield_block_rows(heightfield),
+  };
+  draw.num_runs = (heightfield->depth + draw.grain - 1) / draw.grain;
+  draw.runs = arena_alloc(&renderer->arena, draw.num_runs * sizeof(run_t));
+  if (!draw.runs) return;
+  draw_stages(
+      renderer,
+      &draw,
+      vertex_job_heightfield,
+      heightfield->depth,
+      draw.grain
+  );
+}
+/* Render mesh */
+void renderer_draw(renderer_t *renderer, const mesh_t *mesh) {
+  if (mesh->heightfield) {
+    draw_heightfield(renderer, mesh);
+    return;
+  }
+  mesh_cache_t *cache = get_cache(renderer, mesh);
+  if (!cache) return;
+  draw_t draw = {
+    .renderer = renderer,
+    .view = m4x4_mul(
+        update_camera(renderer),
+        model_matrix(mesh->translate, mesh->scale, mesh->rotate)
+    ),
+    .proj = projection(renderer),
+    .cache = cache,
+    .grain = MESH_CHUNK_TRIS,
+    .num_runs = (mesh->num_tris + MESH_CHUNK_TRIS - 1) / MESH_CHUNK_TRIS,
+  };
+  if (mesh->normals && mesh->normals_version == mesh->version) {
+    /*
+     * Transformed edges cross to the cofactor times the model space cross,
+     * whose columns are the crosses of the matrix's columns
+     */
+    vec3_t c[3];
+    for (uint32_t j = 0; j < 3; j++) {
+      c[j] = V3_FROM(draw.view.m[0][j], draw.view.m[1][j], draw.view.m[2][j]);
+    }
+    draw.normals = mesh->normals;
+    draw.normal_axes[0] = v3cross(c[1], c[2]);
+    draw.normal_axes[1] = v3cross(c[2], c[0]);
+    draw.normal_axes[2] = v3cross(c[0], c[1]);
+  }
+  draw.runs = arena_alloc(&renderer->arena, draw.num_runs * sizeof(run_t));
+  if (!draw.runs) return;
+  draw_stages(renderer, &draw, vertex_job, mesh->num_tris, MESH_CHUNK_TRIS);
+}
+/* Render quantized mesh */
+void renderer_draw_quantized(
+    renderer_t *renderer,
+    const qmesh_t *qmesh
+) {
+  draw_t draw = {
+    .renderer = renderer,
+    .view = m4x4_mul(
+        update_camera(renderer),
+        model_matrix(qmesh->translate, qmesh->scale, qmesh->rotate)
+    ),
+    .proj = projection(renderer),
+    .qmesh = qmesh,
+    .grain = 1,
+    .num_runs = qmesh->num_chunks,
+  };
+  draw.runs = arena_alloc(&renderer->arena, draw.num_runs * sizeof(run_t));
+  if (!draw.runs) return;
+  draw_stages(renderer, &draw, vertex_job_quantized, qmesh->num_chunks, 1);
 }